@@ -0,0 +1,93 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#pragma once
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <thread>
+#include "core_globals.h"
+
+namespace Core {
+
+/**
+ * @brief The CancellationToken class
+ * Signals the cancellation of a query to its handler. Besides polling, a
+ * handler can register callbacks, e.g. to kill a subprocess, block until the
+ * query is cancelled or poll the file descriptor of the token next to the ones
+ * it does I/O on. All functions are thread-safe.
+ */
+class EXPORT_CORE CancellationToken final
+{
+public:
+
+    CancellationToken();
+    ~CancellationToken();
+
+    CancellationToken(const CancellationToken &) = delete;
+    CancellationToken &operator=(const CancellationToken &) = delete;
+
+    /**
+     * @brief Indicates the cancellation
+     */
+    bool isCancelled() const {
+        return cancelled_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Cancels the token
+     * Runs the registered callbacks in the calling thread and wakes the
+     * waiting threads. Does nothing if the token is cancelled already.
+     */
+    void cancel();
+
+    /**
+     * @brief Registers a callback run once on cancellation
+     * If the token is cancelled already the callback is run right away.
+     * Callbacks run in the cancelling thread, often the main thread, so keep
+     * them short.
+     * @return The id to unregister the callback with, 0 if it was run right away
+     */
+    uint64_t registerCallback(std::function<void()> callback) const;
+
+    /**
+     * @brief Unregisters a callback
+     * If the callback is running in another thread, blocks until it returned,
+     * so that the state it uses can be destroyed afterwards. Does not block if
+     * called from within the callback.
+     */
+    void unregisterCallback(uint64_t id) const;
+
+    /**
+     * @brief Blocks until the token is cancelled
+     * @param milliseconds The time to wait at most, negative to wait forever
+     * @return True if the token is cancelled
+     */
+    bool wait(long milliseconds = -1) const;
+
+    /**
+     * @brief A file descriptor that is readable once the token is cancelled
+     * Pass it to poll() or select() to stop waiting on I/O on cancellation.
+     * The token owns the descriptor, do not read or close it. Not available
+     * on platforms other than Unix.
+     * @return The descriptor, -1 on errors or if not available
+     */
+    int fileDescriptor() const;
+
+private:
+
+    std::atomic<bool> cancelled_;
+    mutable QMutex mutex_;
+    mutable QWaitCondition cancellation_;
+    mutable QWaitCondition callbackFinished_;
+    mutable std::map<uint64_t, std::function<void()>> callbacks_;
+    mutable uint64_t lastCallbackId_;
+    uint64_t runningCallbackId_;
+    std::thread::id runningThread_;
+    mutable int pipe_[2];
+
+};
+
+}
@@ -6,7 +6,7 @@
 #include "plugin.h"
 #include "core_globals.h"
 
-#define ALBERT_EXTENSION_IID ALBERT_PLUGIN_IID_PREFIX".extensionv1-alpha"
+#define ALBERT_EXTENSION_IID ALBERT_PLUGIN_IID_PREFIX".extensionv2-alpha"
 
 namespace Core {
 
@@ -1,12 +1,13 @@
 // Copyright (C) 2014-2018 Manuel Schneider
 
 #pragma once
-#include <QMutex>
 #include <QString>
+#include <atomic>
 #include <map>
 #include <memory>
 #include <utility>
 #include <vector>
+#include "cancellationtoken.h"
 #include "core_globals.h"
 
 
@@ -14,6 +15,7 @@ namespace Core {
 
 class QueryPrivate;
 class Item;
+class ResultBuffer;
 
 /**
  * @brief The Query class
@@ -63,6 +65,13 @@ public:
      */
     bool isValid() const;
 
+    /**
+     * @brief The cancellation token of the query
+     * Invalidating the query cancels the token. Use it to get notified, e.g.
+     * to abort blocking I/O or subprocesses right away.
+     */
+    std::shared_ptr<const CancellationToken> cancellationToken() const;
+
     /**
      * @brief addMatch
      * Use the addMatches if you have a lot of items to add.
@@ -72,46 +81,43 @@ public:
      */
     template<typename T>
     void addMatch(T&& item, uint score = 0) {
-        if ( isValid_ ) {
-            mutex_.lock();
-            addMatchWithoutLock(std::forward<T>(item), score);
-            mutex_.unlock();
-        }
+        if ( isValid() )
+            addMatch(buffer(), std::forward<T>(item), score);
     }
 
     /**
      * @brief addMatches
-     * Cumulative addMatch function avoiding excessive mutex locking the results
+     * Cumulative addMatch function looking up the result buffer of the thread once
      * @param begin
      * @param end
      */
     template<typename Iterator>
     void addMatches(Iterator begin, Iterator end) {
         if ( isValid() ) {
-            mutex_.lock();
+            ResultBuffer &results = buffer();
             for (; begin != end; ++begin)
                 // Must not use operator->() !!! dereferencing a pointer returns an lvalue
-                addMatchWithoutLock((*begin).first, (*begin).second);
-            mutex_.unlock();
+                addMatch(results, (*begin).first, (*begin).second);
         }
     }
 
 private:
 
-    void addMatchWithoutLock(const std::shared_ptr<Core::Item> &item, uint score);
-    void addMatchWithoutLock(std::shared_ptr<Core::Item> &&item, uint score);
+    ResultBuffer &buffer();
+    void addMatch(ResultBuffer &results, const std::shared_ptr<Core::Item> &item, uint score);
+    void addMatch(ResultBuffer &results, std::shared_ptr<Core::Item> &&item, uint score);
+    void takeResults(std::vector<std::pair<std::shared_ptr<Item>, uint>> &out);
 
     Query() = default;
-    ~Query() = default;
+    ~Query();
 
-    std::vector<std::pair<std::shared_ptr<Item>, uint>> results_;
-    QMutex mutex_;
+    std::atomic<ResultBuffer*> buffers_{nullptr};  // One per thread adding matches
     QString trigger_;
     QString string_;
     QString rawString_;
-    std::map<QString, uint> scores_;
-    bool sort_ = true;
-    bool isValid_ = true;
+    std::shared_ptr<const std::map<QString, uint>> scores_;
+    std::atomic<bool> sort_{true};
+    std::shared_ptr<CancellationToken> token_ = std::make_shared<CancellationToken>();
 
     friend class QueryExecution;
 };
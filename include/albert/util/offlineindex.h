@@ -4,6 +4,7 @@
 #include <QString>
 #include <vector>
 #include <memory>
+#include <utility>
 #include "../core_globals.h"
 
 namespace Core {
@@ -11,10 +12,90 @@ namespace Core {
 class SearchBase;
 class IndexableItem;
 
+/**
+ * @brief The OfflineIndex class
+ *
+ * Searches may run concurrently with each other and with publish(), move
+ * assignment, setFuzzy() and setSubstring(). These replace the searched index
+ * or its fuzzy or substring layer atomically, running searches finish on the
+ * one they started on. All other
+ * modifications must not overlap with searches, to re-index while serving
+ * searches build a new OfflineIndex off-thread and publish it.
+ */
 class EXPORT_CORE OfflineIndex final {
 
 public:
 
+    /**
+     * @brief The analysis steps applied to index strings and queries
+     *
+     * Without any step terms are lowercased only, which is the default.
+     * Extensions opt in to the steps they want by setAnalysis().
+     */
+    enum Analysis : uint {
+        CaseFolding = 0x1,       ///< Case fold instead of lowercase, e.g. "ß" -> "ss"
+        Normalization = 0x2,     ///< Compatibility decomposition (NFKD), e.g. "ﬁ" -> "fi"
+        DiacriticFolding = 0x4,  ///< Strip diacritics, e.g. "É" -> "e"
+        Acronyms = 0x8,          ///< Index the initials of words and camel case parts, e.g. "VisualStudioCode" -> "vsc", for names like the ones of applications
+        DefaultAnalysis = 0
+    };
+
+    /**
+     * @brief The matches of a search, refined by the next one
+     *
+     * Pass the same cursor to the searches of successive keystrokes. If the
+     * query extends the previous one, e.g. "firef" after "fire", the previous
+     * matches are filtered instead of searching the index again. The cursor
+     * is reset implicitly if the index changed meanwhile. A cursor must not be
+     * used by concurrent searches.
+     */
+    class EXPORT_CORE Cursor final {
+    public:
+        Cursor();
+        ~Cursor();
+    private:
+        friend class OfflineIndex;
+        struct Private;
+        std::unique_ptr<Private> d;
+    };
+
+    /**
+     * @brief The best matches of a search, as handles into the index
+     *
+     * Scoring and ranking work on dense item ids, the items are not touched.
+     * The matches borrow the items from the searched index, which they keep
+     * alive. Call share() only for the matches passed on, e.g. to
+     * Query::addMatches, to avoid copying shared pointers of the others. The
+     * borrowed items are valid until the index is modified.
+     */
+    class EXPORT_CORE Matches final {
+    public:
+        Matches();
+        Matches(Matches &&other);
+        Matches &operator=(Matches &&other);
+        ~Matches();
+
+        /** The number of matches */
+        size_t size() const { return matches_.size(); }
+
+        /** True if nothing matched */
+        bool empty() const { return matches_.empty(); }
+
+        /** The item of the i-th match */
+        Core::IndexableItem *item(size_t i) const;
+
+        /** The score of the i-th match (UINT_MAX -> 1) */
+        uint score(size_t i) const { return matches_[i].second; }
+
+        /** Shares the item of the i-th match */
+        std::shared_ptr<Core::IndexableItem> share(size_t i) const;
+
+    private:
+        friend class OfflineIndex;
+        std::shared_ptr<const SearchBase> index_;
+        std::vector<std::pair<uint,uint>> matches_;  // Item id, score
+    };
+
     /**
      * @brief Contstructs a search
      * @param fuzzy Sets the type of the search. Defaults to false.
@@ -25,6 +106,16 @@ public:
     OfflineIndex &operator=(const OfflineIndex & other) = delete;
     OfflineIndex &operator=(OfflineIndex && other);
 
+    /**
+     * @brief Replace the searched index by another one
+     *
+     * The swap is atomic. Searches running concurrently keep the previous
+     * index alive until they finished, then it is destroyed.
+     *
+     * @param other The index to publish, empty afterwards
+     */
+    void publish(OfflineIndex &&other);
+
     /**
      * @brief Destructs the search
      * @param
@@ -33,6 +124,11 @@ public:
 
     /**
      * @brief Sets the type of the search to fuzzy
+     *
+     * The fuzzy search is a layer over the terms of the index. Setting the
+     * type builds or frees the layer only, the index is neither copied nor
+     * rebuilt.
+     *
      * @param fuzzy The type to set. Defaults to true.
      */
     void setFuzzy(bool fuzzy = true);
@@ -43,6 +139,24 @@ public:
      */
     bool fuzzy();
 
+    /**
+     * @brief Sets the type of the search to substring
+     *
+     * A substring search matches query words anywhere in the words of the
+     * index strings, e.g. "report" in "q3report_final.pdf", in time
+     * logarithmic in the size of the index. Exact prefixes rank first. Setting
+     * the type to fuzzy replaces the substring search.
+     *
+     * @param substring The type to set. Defaults to true.
+     */
+    void setSubstring(bool substring = true);
+
+    /**
+     * @brief Type of the search
+     * @return True if the search is a substring search else false.
+     */
+    bool substring();
+
     /**
      * @brief Set the error tolerance of the fuzzy search
      *
@@ -61,26 +175,162 @@ public:
      */
     double delta();
 
+    /**
+     * @brief Set the analysis steps applied to index strings and queries
+     *
+     * The analysis is applied once per term at index time and once per query
+     * word, exact prefixes of the analyzed terms match. Folding lets "ecran"
+     * match "Écran" without fuzzy search. Changing the analysis reindexes the
+     * items.
+     *
+     * @param analysis The Analysis flags
+     */
+    void setAnalysis(uint analysis);
+
+    /**
+     * @brief The analysis steps applied to index strings and queries
+     * @return The Analysis flags
+     */
+    uint analysis();
+
     /**
      * @brief Build the search index
      * @param The items to index
      */
     void add(const std::shared_ptr<Core::IndexableItem> &idxble);
 
+    /**
+     * @brief Remove an item from the search index
+     *
+     * Items are identified by their id. The item is hidden from the results
+     * immediately, its postings are dropped by a compaction in the background
+     * or the next build().
+     *
+     * @param The item to remove
+     */
+    void remove(const std::shared_ptr<Core::IndexableItem> &idxble);
+
+    /**
+     * @brief Replace the item with the same id in the search index
+     * @param The changed item
+     */
+    void update(const std::shared_ptr<Core::IndexableItem> &idxble);
+
+    /**
+     * @brief Bulk load the added items into the compact search index
+     *
+     * Lays out the terms added so far as a sorted, contiguous dictionary. Call
+     * this once after the last add(). Items added afterwards are searchable
+     * too, but searched in the slower staging index until the next build().
+     */
+    void build();
+
+    /**
+     * @brief Bulk load items into the compact search index
+     *
+     * Like calling add() for each item and build() afterwards, but the items
+     * are tokenized and the dictionary is merged using all cores.
+     *
+     * @param items The items to index
+     */
+    void build(const std::vector<std::shared_ptr<Core::IndexableItem>> &items);
+
     /**
      * @brief Clear the search index
      */
     void clear();
 
+    /**
+     * @brief Save the search index to a file
+     *
+     * Builds the index and writes it to a versioned, checksummed file, which
+     * replaces the file at path atomically. The file holds the ids of the
+     * items, not the items themselves. The file is bound to the byte order of
+     * the host.
+     *
+     * @param path The path of the index file
+     * @return True on success
+     */
+    bool save(const QString &path);
+
+    /**
+     * @brief Load the search index from a file
+     *
+     * The file is memory mapped, the dictionary, its posting lists, the qGram
+     * table and the suffix array are used in place. Processes loading the same file share its
+     * pages. The type of the search is the one of the saved index. The loaded
+     * index is published like by publish().
+     *
+     * @param path The path of the index file
+     * @param items The indexed items, looked up by their ids
+     * @return False if the file is missing, invalid or any item indexed in it
+     * is not among the items. The index is not changed then.
+     */
+    bool load(const QString &path, const std::vector<std::shared_ptr<Core::IndexableItem>> &items);
+
     /**
      * @brief Perform a search on the index
      * @param req The query string
      */
     std::vector<std::shared_ptr<Core::IndexableItem>> search(const QString &req) const;
 
+    /**
+     * @brief Perform a search on the index, returning the best matches only
+     *
+     * Every query word scores the relevance of the index string it matches,
+     * weighted by the match quality, i.e. the share of the matched word the
+     * query word covers and, if fuzzy, its edit distance. The score of a match
+     * is the mean over the query words. Only the k best matches are returned,
+     * the others are never materialized.
+     *
+     * @param req The query string
+     * @param k The maximum number of matches to return
+     * @return The matches and their scores (UINT_MAX -> 1), best first
+     */
+    std::vector<std::pair<std::shared_ptr<Core::IndexableItem>,uint>> search(const QString &req, size_t k) const;
+
+    /**
+     * @brief Perform a search on the index, refining the previous one
+     * @param req The query string
+     * @param cursor The cursor of the previous search, updated to this one
+     */
+    std::vector<std::shared_ptr<Core::IndexableItem>> search(const QString &req, Cursor &cursor) const;
+
+    /**
+     * @brief Perform a search on the index returning the best matches only,
+     * refining the previous one
+     * @param req The query string
+     * @param k The maximum number of matches to return
+     * @param cursor The cursor of the previous search, updated to this one
+     * @return The matches and their scores (UINT_MAX -> 1), best first
+     */
+    std::vector<std::pair<std::shared_ptr<Core::IndexableItem>,uint>> search(const QString &req, size_t k, Cursor &cursor) const;
+
+    /**
+     * @brief Perform a search on the index, returning handles to the best
+     * matches only
+     *
+     * Scores like search(req, k), but no item is materialized.
+     *
+     * @param req The query string
+     * @param k The maximum number of matches to return
+     * @return The matches, best first
+     */
+    Matches match(const QString &req, size_t k) const;
+
+    /**
+     * @brief Perform a search on the index returning handles to the best
+     * matches only, refining the previous one
+     * @param req The query string
+     * @param k The maximum number of matches to return
+     * @param cursor The cursor of the previous search, updated to this one
+     * @return The matches, best first
+     */
+    Matches match(const QString &req, size_t k, Cursor &cursor) const;
+
 private:
 
-    std::unique_ptr<SearchBase> impl_;
+    std::shared_ptr<SearchBase> impl_;
 
 };
 
@@ -0,0 +1,132 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#include <QMutexLocker>
+#include <chrono>
+#include <utility>
+#include "albert/cancellationtoken.h"
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+using std::function;
+
+
+/** ***************************************************************************/
+Core::CancellationToken::CancellationToken()
+    : cancelled_(false), lastCallbackId_(0), runningCallbackId_(0), pipe_{-1, -1} {
+
+}
+
+
+/** ***************************************************************************/
+Core::CancellationToken::~CancellationToken() {
+#ifdef Q_OS_UNIX
+    if ( pipe_[0] != -1 ) {
+        close(pipe_[0]);
+        close(pipe_[1]);
+    }
+#endif
+}
+
+
+/** ***************************************************************************/
+void Core::CancellationToken::cancel() {
+
+    QMutexLocker lock(&mutex_);
+    if ( cancelled_.exchange(true, std::memory_order_acq_rel) )
+        return;
+    cancellation_.wakeAll();
+#ifdef Q_OS_UNIX
+    if ( pipe_[1] != -1 ) {
+        char byte = 0;
+        ssize_t written = write(pipe_[1], &byte, 1);
+        Q_UNUSED(written)
+    }
+#endif
+
+    // Run the callbacks unlocked, they may use the token. The running one is
+    // recorded for unregisterCallback to wait for.
+    runningThread_ = std::this_thread::get_id();
+    while ( !callbacks_.empty() ) {
+        auto first = callbacks_.begin();
+        function<void()> callback = std::move(first->second);
+        runningCallbackId_ = first->first;
+        callbacks_.erase(first);
+        lock.unlock();
+        callback();
+        lock.relock();
+        runningCallbackId_ = 0;
+        callbackFinished_.wakeAll();
+    }
+}
+
+
+/** ***************************************************************************/
+uint64_t Core::CancellationToken::registerCallback(function<void()> callback) const {
+    {
+        QMutexLocker lock(&mutex_);
+        if ( !cancelled_.load(std::memory_order_relaxed) ) {
+            callbacks_.emplace(++lastCallbackId_, std::move(callback));
+            return lastCallbackId_;
+        }
+    }
+    callback();
+    return 0;
+}
+
+
+/** ***************************************************************************/
+void Core::CancellationToken::unregisterCallback(uint64_t id) const {
+    QMutexLocker lock(&mutex_);
+    if ( callbacks_.erase(id) > 0 || runningThread_ == std::this_thread::get_id() )
+        return;
+    while ( id != 0 && runningCallbackId_ == id )
+        callbackFinished_.wait(&mutex_);
+}
+
+
+/** ***************************************************************************/
+bool Core::CancellationToken::wait(long milliseconds) const {
+    QMutexLocker lock(&mutex_);
+    if ( milliseconds < 0 ) {
+        while ( !cancelled_.load(std::memory_order_relaxed) )
+            cancellation_.wait(&mutex_);
+        return true;
+    }
+
+    steady_clock::time_point deadline = steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    while ( !cancelled_.load(std::memory_order_relaxed) ) {
+        long left = duration_cast<std::chrono::milliseconds>(deadline - steady_clock::now()).count();
+        if ( left <= 0 )
+            return false;
+        cancellation_.wait(&mutex_, static_cast<unsigned long>(left));
+    }
+    return true;
+}
+
+
+/** ***************************************************************************/
+int Core::CancellationToken::fileDescriptor() const {
+#ifndef Q_OS_UNIX
+    return -1;
+#else
+    QMutexLocker lock(&mutex_);
+    if ( pipe_[0] == -1 ) {
+        // Created on demand, most handlers never ask for it
+        if ( pipe(pipe_) != 0 ) {
+            pipe_[0] = pipe_[1] = -1;
+            return -1;
+        }
+        fcntl(pipe_[0], F_SETFD, FD_CLOEXEC);
+        fcntl(pipe_[1], F_SETFD, FD_CLOEXEC);
+        if ( cancelled_.load(std::memory_order_relaxed) ) {
+            char byte = 0;
+            ssize_t written = write(pipe_[1], &byte, 1);
+            Q_UNUSED(written)
+        }
+    }
+    return pipe_[0];
+#endif
+}
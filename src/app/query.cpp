@@ -1,9 +1,11 @@
 // Copyright (C) 2014-2018 Manuel Schneider
 
 #include <QDebug>
+#include <thread>
 #include "albert/item.h"
 #include "albert/query.h"
 #include "matchcompare.h"
+#include "resultbuffer.h"
 
 
 /** ***************************************************************************/
@@ -38,25 +40,68 @@ const QString &Core::Query::trigger() const {
 
 /** ***************************************************************************/
 bool Core::Query::isValid() const {
-    return isValid_;
+    return !token_->isCancelled();
 }
 
 
 /** ***************************************************************************/
-void Core::Query::addMatchWithoutLock(const std::shared_ptr<Core::Item> &item, uint score) {
-    auto it = scores_.find(item->id());
-    if ( it == scores_.end() )
-        results_.emplace_back(item, 0 /*score/2*/);
+std::shared_ptr<const Core::CancellationToken> Core::Query::cancellationToken() const {
+    return token_;
+}
+
+
+/** ***************************************************************************/
+Core::Query::~Query() {
+    ResultBuffer *buffer = buffers_.load(std::memory_order_acquire);
+    while ( buffer ) {
+        ResultBuffer *next = buffer->next;
+        delete buffer;
+        buffer = next;
+    }
+}
+
+
+/** ***************************************************************************/
+Core::ResultBuffer &Core::Query::buffer() {
+
+    // Threads add to buffers of their own, usually there is only one
+    std::thread::id thread = std::this_thread::get_id();
+    ResultBuffer *head = buffers_.load(std::memory_order_acquire);
+    for ( ResultBuffer *buffer = head; buffer; buffer = buffer->next )
+        if ( buffer->thread() == thread )
+            return *buffer;
+
+    ResultBuffer *buffer = new ResultBuffer(thread);
+    do
+        buffer->next = head;
+    while ( !buffers_.compare_exchange_weak(head, buffer, std::memory_order_release,
+                                            std::memory_order_acquire) );
+    return *buffer;
+}
+
+
+/** ***************************************************************************/
+void Core::Query::addMatch(ResultBuffer &results, const std::shared_ptr<Core::Item> &item, uint score) {
+    auto it = scores_->find(item->id());
+    if ( it == scores_->end() )
+        results.append(item, 0 /*score/2*/);
     else
-        results_.emplace_back(item, it->second/*(static_cast<ulong>(score)+it->second)/2*/);
+        results.append(item, it->second/*(static_cast<ulong>(score)+it->second)/2*/);
 }
 
 
 /** ***************************************************************************/
-void Core::Query::addMatchWithoutLock(std::shared_ptr<Core::Item> &&item, uint score) {
-    auto it = scores_.find(item->id());
-    if ( it == scores_.end() )
-        results_.emplace_back(std::move(item), 0/*score/2*/);
+void Core::Query::addMatch(ResultBuffer &results, std::shared_ptr<Core::Item> &&item, uint score) {
+    auto it = scores_->find(item->id());
+    if ( it == scores_->end() )
+        results.append(std::move(item), 0/*score/2*/);
     else
-        results_.emplace_back(std::move(item), it->second/*(static_cast<ulong>(score)+it->second)/2*/);
+        results.append(std::move(item), it->second/*(static_cast<ulong>(score)+it->second)/2*/);
+}
+
+
+/** ***************************************************************************/
+void Core::Query::takeResults(std::vector<std::pair<std::shared_ptr<Item>, uint>> &out) {
+    for ( ResultBuffer *buffer = buffers_.load(std::memory_order_acquire); buffer; buffer = buffer->next )
+        buffer->take(out);
 }
@@ -1,10 +1,13 @@
 // Copyright (C) 2014-2018 Manuel Schneider
 
 #include <QDebug>
+#include <QFutureInterface>
+#include <QRunnable>
 #include <QString>
+#include <QThreadPool>
 #include <QVariant>
-#include <QtConcurrent>
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <functional>
 #include <utility>
@@ -20,17 +23,52 @@ using namespace chrono;
 
 namespace {
     const int FETCH_SIZE = 20;
+    const int DEADLINE_CHECK_INTERVAL = 10;
+
+    class FunctionRunnable final : public QRunnable
+    {
+    public:
+        explicit FunctionRunnable(function<void()> function) : function_(move(function)) {}
+        void run() override { function_(); }
+    private:
+        function<void()> function_;
+    };
 }
 
 
+/** ***************************************************************************/
+struct Core::QueryExecution::HandlerRun {
+    enum class Phase { Queued, Running, Released, Done };
+    QueryHandler *handler;
+    shared_ptr<Query> query;
+    system_clock::time_point enqueued;
+    atomic<system_clock::rep> start{0};  // Set by the worker, 0 until it runs
+    atomic<Phase> phase{Phase::Queued};  // Released if its thread does not count against the pool
+    uint runtime = 0;
+    bool ended = false;
+};
+
+
 /** ***************************************************************************/
 Core::QueryExecution::QueryExecution(const set<QueryHandler*> & queryHandlers,
                                      const set<FallbackProvider*> &fallbackProviders,
                                      const QString &queryString,
-                                     std::map<QString,uint> scores,
-                                     bool fetchIncrementally) {
+                                     shared_ptr<const map<QString,uint>> scores,
+                                     bool fetchIncrementally,
+                                     QueryBudgets budgets,
+                                     QThreadPool *threadPool,
+                                     int priority) {
 
     fetchIncrementally_ = fetchIncrementally;
+    threadPool_ = threadPool;
+    priority_ = priority;
+    budgets_ = budgets;
+    batchLatencyTimer_.setSingleShot(true);
+    batchLatencyTimer_.setInterval(budgets_.batchLatency);
+    deadlineTimer_.setInterval(DEADLINE_CHECK_INTERVAL);
+    connect(&deadlineTimer_, &QTimer::timeout, this, &QueryExecution::onDeadlineTimeout);
+    connect(&futureWatcher_, &QFutureWatcher<uint>::resultReadyAt,
+            this, &QueryExecution::onHandlerFinished);
     query_.rawString_ = queryString;
     query_.string_    = queryString;
     query_.scores_ = move(scores);
@@ -84,8 +122,10 @@ const Core::QueryExecution::State &Core::QueryExecution::state() const {
 /** ***************************************************************************/
 void Core::QueryExecution::setState(State state) {
     state_ = state;
-    if (state_ == State::Finished)
+    if (state_ == State::Finished) {
         stats.end = system_clock::now();
+        deadlineTimer_.stop();
+    }
     emit stateChanged(state_);
 }
 
@@ -97,8 +137,12 @@ void Core::QueryExecution::run() {
 
     stats.start = system_clock::now();
 
-    if ( !batchHandlers_.empty() )
+    if ( !batchHandlers_.empty() ) {
+        // The deadlines apply to the batch handlers only
+        if ( budgets_.handlerDeadline >= 0 || budgets_.queryDeadline >= 0 )
+            deadlineTimer_.start();
         return runBatchHandlers();
+    }
 
     emit resultsReady(this);
 
@@ -111,44 +155,240 @@ void Core::QueryExecution::run() {
 
 /** ***************************************************************************/
 void Core::QueryExecution::cancel() {
+    batchLatencyTimer_.stop();
+    deadlineTimer_.stop();
     futureWatcher_.disconnect();
     future_.cancel();
-    query_.isValid_ = false;
+    query_.token_->cancel();
+    for ( auto &run : runs_ ) {
+        run->query->token_->cancel();
+        releaseThread(*run);
+    }
     stats.cancelled = true;
 }
 
 
+/** ***************************************************************************
+ * @brief Stops counting the thread of a cancelled run against the pool, so that
+ * a handler ignoring the cancellation does not hold back the queued runs. The
+ * worker takes the thread back once the handler returned.
+ */
+void Core::QueryExecution::releaseThread(HandlerRun &run) {
+    HandlerRun::Phase running = HandlerRun::Phase::Running;
+    if ( run.phase.compare_exchange_strong(running, HandlerRun::Phase::Released) )
+        threadPool_->releaseThread();
+}
+
+
+/** ***************************************************************************/
+void Core::QueryExecution::runHandlers(const set<QueryHandler*> &handlers, const char *label) {
+
+    // Every handler gets a query of its own, so that it can be cancelled alone.
+    // The runs of the batch handlers are kept, the indices of the runs stay
+    // valid for the results of their future still queued.
+    size_t first = runs_.size();
+    for ( QueryHandler *handler : handlers ) {
+        shared_ptr<HandlerRun> run = make_shared<HandlerRun>();
+        run->handler = handler;
+        run->query.reset(new Query, [](Query *query){ delete query; });
+        run->query->trigger_ = query_.trigger_;
+        run->query->string_ = query_.string_;
+        run->query->rawString_ = query_.rawString_;
+        run->query->scores_ = query_.scores_;
+        runs_.push_back(move(run));
+    }
+    pendingRuns_ = static_cast<int>(runs_.size() - first);
+
+    // Run the handlers on the query pool and measure the runtimes. The runs
+    // are shared with the workers, since a cancelled handler may outlive this.
+    // The runtimes are reported at the index of the run.
+    QFutureInterface<uint> interface;
+    interface.reportStarted();
+    future_ = interface.future();
+    shared_ptr<atomic<int>> remaining = make_shared<atomic<int>>(pendingRuns_);
+    QThreadPool *threadPool = threadPool_;
+    for ( size_t i = first; i < runs_.size(); ++i ) {
+        shared_ptr<HandlerRun> run = runs_[i];
+        int index = static_cast<int>(i);
+        run->enqueued = system_clock::now();
+        threadPool_->start(new FunctionRunnable([run, interface, index, remaining, label, threadPool]() mutable {
+            // Queued runs of superseded queries are skipped
+            if ( !interface.isCanceled() && run->query->isValid() ) {
+                system_clock::time_point start = system_clock::now();
+                run->start = start.time_since_epoch().count();
+                run->phase = HandlerRun::Phase::Running;
+                run->handler->handleQuery(run->query.get());
+                HandlerRun::Phase running = HandlerRun::Phase::Running;
+                if ( !run->phase.compare_exchange_strong(running, HandlerRun::Phase::Done) )
+                    threadPool->reserveThread();  // Released by a cancellation meanwhile
+                long duration = duration_cast<microseconds>(system_clock::now()-start).count();
+                qDebug() << qPrintable(QString("TIME: %1 µs MATCHES%2 [%3]").arg(duration, 6).arg(label).arg(run->handler->id));
+                run->runtime = static_cast<uint>(duration);
+            }
+            interface.reportResult(run->runtime, index);
+            if ( --*remaining == 0 )
+                interface.reportFinished();
+        }), priority_);
+    }
+    futureWatcher_.setFuture(future_);
+}
+
+
+/** ***************************************************************************/
+void Core::QueryExecution::onHandlerFinished(int index) {
+
+    if ( index < 0 || static_cast<size_t>(index) >= runs_.size() )
+        return;
+
+    HandlerRun &run = *runs_[static_cast<size_t>(index)];
+    if ( run.ended )  // Cancelled by a deadline before
+        return;
+
+    run.ended = true;
+    stats.runtimes.emplace(run.handler->id, run.runtime);
+    --pendingRuns_;
+    onHandlerRunsEnded();
+}
+
+
+/** ***************************************************************************/
+void Core::QueryExecution::onDeadlineTimeout() {
+
+    system_clock::time_point now = system_clock::now();
+    bool queryOverrun = budgets_.queryDeadline >= 0
+            && now - stats.start >= milliseconds(budgets_.queryDeadline);
+
+    int overruns = 0;
+    for ( auto &run : runs_ ) {
+        if ( run->ended )
+            continue;
+
+        // The time spent queued counts, a handler waiting for a thread of
+        // the pool overruns too
+        bool handlerOverrun = budgets_.handlerDeadline >= 0
+                && now - run->enqueued >= milliseconds(budgets_.handlerDeadline);
+        if ( !queryOverrun && !handlerOverrun )
+            continue;
+
+        // Cancel the handler and keep what it added so far
+        system_clock::rep start = run->start;
+        run->query->token_->cancel();
+        releaseThread(*run);
+        run->ended = true;
+        long duration = start == 0 ? 0 : duration_cast<microseconds>(
+                    now - system_clock::time_point(system_clock::duration(start))).count();
+        stats.runtimes.emplace(run->handler->id, static_cast<uint>(duration));
+        stats.overruns.insert(run->handler->id);
+        qWarning() << qPrintable(QString("Handler exceeded its deadline, cancelled after %1 µs [%2]")
+                                 .arg(duration).arg(run->handler->id));
+        ++overruns;
+    }
+
+    if ( overruns > 0 ) {
+        pendingRuns_ -= overruns;
+        onHandlerRunsEnded();
+    }
+}
+
+
+/** ***************************************************************************/
+void Core::QueryExecution::onHandlerRunsEnded() {
+
+    if ( runningRealtime_ ) {
+        if ( pendingRuns_ == 0 )
+            onRealtimeHandlersFinsished();
+        return;
+    }
+
+    // Merge the results of every handler ending after the results are shown
+    if ( resultsShown_ )
+        mergePendingResults();
+
+    if ( pendingRuns_ == 0 )
+        onBatchHandlersFinished();
+}
+
+
+/** ***************************************************************************/
+vector<pair<shared_ptr<Core::Item>,uint>> Core::QueryExecution::takePendingResults() {
+    vector<pair<shared_ptr<Item>,uint>> pending;
+    for ( auto &run : runs_ ) {
+        // Handlers may disable sorting at any time, also before they finish
+        // or overrun their deadline
+        if ( !run->query->sort_ )
+            query_.sort_ = false;
+        run->query->takeResults(pending);
+    }
+    return pending;
+}
+
+
 /** ***************************************************************************/
 void Core::QueryExecution::runBatchHandlers() {
 
-    // Call onBatchHandlersFinished when all handlers finished
-    connect(&futureWatcher_, &QFutureWatcher<pair<QueryHandler*,uint>>::finished,
-            this, &QueryExecution::onBatchHandlersFinished);
-
-    // Run the handlers concurrently and measure the runtimes
-    function<pair<QueryHandler*,uint>(QueryHandler*)> func = [this](QueryHandler* queryHandler){
-        system_clock::time_point start = system_clock::now();
-        queryHandler->handleQuery(&query_);
-        long duration = duration_cast<microseconds>(system_clock::now()-start).count();
-        qDebug() << qPrintable(QString("TIME: %1 µs MATCHES [%2]").arg(duration, 6).arg(queryHandler->id));
-        return make_pair(queryHandler, static_cast<int>(duration));
-    };
-    future_ = QtConcurrent::mapped(batchHandlers_.begin(), batchHandlers_.end(), func);
-    futureWatcher_.setFuture(future_);
+    // Show the results gathered so far when the budget expires
+    connect(&batchLatencyTimer_, &QTimer::timeout,
+            this, &QueryExecution::onBatchLatencyBudgetExpired);
+
+    runHandlers(batchHandlers_, "");
+
+    // A negative budget waits for all handlers
+    if ( batchLatencyTimer_.interval() >= 0 )
+        batchLatencyTimer_.start();
+}
+
+
+/** ***************************************************************************/
+void Core::QueryExecution::onBatchLatencyBudgetExpired() {
+
+    if ( resultsShown_ || state_ != State::Running )
+        return;
+
+    takeBatchResults();
+    resultsShown_ = true;
+    emit resultsReady(this);
 }
 
 
 /** ***************************************************************************/
 void Core::QueryExecution::onBatchHandlersFinished() {
 
-    // Save the runtimes of the current future
-    for ( auto it = future_.begin(); it != future_.end(); ++it )
-        stats.runtimes.emplace(it->first->id, it->second);
+    batchLatencyTimer_.stop();
+    batchLatencyTimer_.disconnect();
+
+    // Handlers cancelled by a deadline may still be queued
+    future_.cancel();
+
+    if ( !resultsShown_ )
+        takeBatchResults();
+
+    if ( realtimeHandlers_.empty() ){
+        if( results_.empty() && !fallbacks_.empty() && !query_.isTriggered() && !query_.rawString_.isEmpty() ){
+            if ( resultsShown_ )
+                beginInsertRows(QModelIndex(), 0, static_cast<int>(fallbacks_.size()-1));
+            results_ = fallbacks_;
+            sortedItems_ = static_cast<int>(fallbacks_.size());
+            fetchIncrementally_ = false;
+            if ( resultsShown_ )
+                endInsertRows();
+        }
+        setState(State::Finished);
+    }
+    else
+        runRealtimeHandlers();
+
+    if ( !resultsShown_ ) {
+        resultsShown_ = true;
+        emit resultsReady(this);
+    }
+}
+
+
+/** ***************************************************************************/
+void Core::QueryExecution::takeBatchResults() {
 
     // Move the items of the "pending results" into "results"
-    query_.mutex_.lock();
-    swap(query_.results_, results_);
-    query_.mutex_.unlock();
+    results_ = takePendingResults();
 
     // Sort the results
     if (query_.trigger_.isNull() || query_.sort_){
@@ -161,42 +401,72 @@ void Core::QueryExecution::onBatchHandlersFinished() {
         else
             std::sort(results_.begin(), results_.end(), MatchCompare());
     }
+}
+
+
+/** ***************************************************************************/
+void Core::QueryExecution::mergePendingResults() {
+
+    vector<pair<shared_ptr<Item>,uint>> pending = takePendingResults();
+    if ( pending.empty() )
+        return;
+
+    // Unsorted results are appended in the order of arrival
+    if ( !(query_.trigger_.isNull() || query_.sort_) ) {
+        beginInsertRows(QModelIndex(),
+                        static_cast<int>(results_.size()),
+                        static_cast<int>(results_.size() + pending.size() - 1));
+        move(pending.begin(), pending.end(), back_inserter(results_));
+        endInsertRows();
+        return;
+    }
 
-    if ( realtimeHandlers_.empty() ){
-        if( results_.empty() && !query_.isTriggered() && !query_.rawString_.isEmpty() ){
-            results_ = fallbacks_;
-            sortedItems_ = static_cast<int>(fallbacks_.size());
-            fetchIncrementally_ = false;
-        }
-        setState(State::Finished);
+    // Ties keep the order of arrival, the new results go after the shown ones
+    stable_sort(pending.begin(), pending.end(), MatchCompare());
+
+    // When fetching incrementally only the results ranking above the last
+    // sorted row are inserted, the others join the unsorted tail
+    auto split = pending.end();
+    if ( fetchIncrementally_ )
+        split = sortedItems_ == 0
+                ? pending.begin()
+                : lower_bound(pending.begin(), pending.end(),
+                              results_[static_cast<size_t>(sortedItems_-1)], MatchCompare());
+
+    // Insert the runs of results going in between the same rows at once
+    size_t rows = fetchIncrementally_ ? static_cast<size_t>(sortedItems_) : results_.size();
+    for ( auto it = pending.begin(); it != split; ) {
+        auto pos = upper_bound(results_.begin(), results_.begin() + static_cast<long>(rows),
+                               *it, MatchCompare());
+        auto end = (pos == results_.begin() + static_cast<long>(rows))
+                ? split : lower_bound(it, split, *pos, MatchCompare());
+        int row = static_cast<int>(pos - results_.begin());
+        int count = static_cast<int>(end - it);
+        beginInsertRows(QModelIndex(), row, row + count - 1);
+        results_.insert(pos, make_move_iterator(it), make_move_iterator(end));
+        rows += static_cast<size_t>(count);
+        if ( fetchIncrementally_ )
+            sortedItems_ += count;
+        endInsertRows();
+        it = end;
     }
-    else
-        runRealtimeHandlers();
 
-    emit resultsReady(this);
+    if ( split != pending.end() ) {
+        move(split, pending.end(), back_inserter(results_));
+        if ( sortedItems_ < FETCH_SIZE )
+            fetchMore(QModelIndex());
+    }
 }
 
 
 /** ***************************************************************************/
 void Core::QueryExecution::runRealtimeHandlers() {
 
-    // Call onRealtimeHandlersFinsished when all handlers finished
-    disconnect(&futureWatcher_, &QFutureWatcher<pair<QueryHandler*,uint>>::finished,
-               this, &QueryExecution::onBatchHandlersFinished);
-
-    connect(&futureWatcher_, &QFutureWatcher<pair<QueryHandler*,uint>>::finished,
-            this, &QueryExecution::onRealtimeHandlersFinsished);
-
-    // Run the handlers concurrently and measure the runtimes
-    function<pair<QueryHandler*,uint>(QueryHandler*)> func = [this](QueryHandler* queryHandler){
-        system_clock::time_point start = system_clock::now();
-        queryHandler->handleQuery(&query_);
-        long duration = duration_cast<microseconds>(system_clock::now()-start).count();
-        qDebug() << qPrintable(QString("TIME: %1 µs MATCHES REALTIME [%2]").arg(duration, 6).arg(queryHandler->id));
-        return make_pair(queryHandler, static_cast<int>(duration));
-    };
-    future_ = QtConcurrent::mapped(realtimeHandlers_.begin(), realtimeHandlers_.end(), func);
-    futureWatcher_.setFuture(future_);
+    // Realtime handlers stream their results, they are not cancelled by the
+    // deadlines
+    deadlineTimer_.stop();
+    runningRealtime_ = true;
+    runHandlers(realtimeHandlers_, " REALTIME");
 
     // Insert pending results every 50 milliseconds
     connect(&fiftyMsTimer_, &QTimer::timeout, this, &QueryExecution::insertPendingResults);
@@ -207,16 +477,14 @@ void Core::QueryExecution::runRealtimeHandlers() {
 /** ***************************************************************************/
 void Core::QueryExecution::onRealtimeHandlersFinsished() {
 
-    // Save the runtimes of the current future
-    for ( auto it = future_.begin(); it != future_.end(); ++it )
-        stats.runtimes.emplace(it->first->id, it->second);
-
     // Finally done
+    futureWatcher_.disconnect();
+    future_.cancel();
     fiftyMsTimer_.stop();
     fiftyMsTimer_.disconnect();
     insertPendingResults();
 
-    if( results_.empty() && !query_.isTriggered() && !query_.rawString_.isEmpty() ){
+    if( results_.empty() && !fallbacks_.empty() && !query_.isTriggered() && !query_.rawString_.isEmpty() ){
         beginInsertRows(QModelIndex(), 0, static_cast<int>(fallbacks_.size()-1));
         results_ = fallbacks_;
         endInsertRows();
@@ -229,22 +497,21 @@ void Core::QueryExecution::onRealtimeHandlersFinsished() {
 /** ***************************************************************************/
 void Core::QueryExecution::insertPendingResults() {
 
-    if(query_.results_.size()) {
-        QMutexLocker lock(&query_.mutex_);
-
-        // When fetching incrementally, only emit if this is in the fetched range
-        if ( !fetchIncrementally_ || sortedItems_ == static_cast<int>(results_.size()) ){
-            beginInsertRows(QModelIndex(),
-                            static_cast<int>(results_.size()),
-                            static_cast<int>(results_.size() + query_.results_.size() - 1));
-            results_.reserve(results_.size() + query_.results_.size());
-            move(query_.results_.begin(), query_.results_.end(), back_inserter(results_));
-            endInsertRows();
-        } else {
-            results_.reserve(results_.size() + query_.results_.size());
-            move(query_.results_.begin(), query_.results_.end(), back_inserter(results_));
-        }
-        query_.results_.clear();
+    vector<pair<shared_ptr<Item>,uint>> pending = takePendingResults();
+    if ( pending.empty() )
+        return;
+
+    // When fetching incrementally, only emit if this is in the fetched range
+    if ( !fetchIncrementally_ || sortedItems_ == static_cast<int>(results_.size()) ){
+        beginInsertRows(QModelIndex(),
+                        static_cast<int>(results_.size()),
+                        static_cast<int>(results_.size() + pending.size() - 1));
+        results_.reserve(results_.size() + pending.size());
+        move(pending.begin(), pending.end(), back_inserter(results_));
+        endInsertRows();
+    } else {
+        results_.reserve(results_.size() + pending.size());
+        move(pending.begin(), pending.end(), back_inserter(results_));
     }
 }
 
@@ -13,6 +13,8 @@
 #include <vector>
 #include "albert/query.h"
 
+class QThreadPool;
+
 namespace Core {
 
 class QueryHandler;
@@ -25,14 +27,38 @@ struct QueryStatistics {
     std::chrono::system_clock::time_point start;
     std::chrono::system_clock::time_point end;
     std::map<QString, uint> runtimes;
+    std::set<QString> overruns;  // Handlers cancelled by a deadline
     bool cancelled = false;
     QString activatedItem;
 };
 
 
+/**
+ * @brief The time limits of a query execution in milliseconds, negative if unlimited
+ */
+struct QueryBudgets {
+    int batchLatency;     // Until the batch results gathered so far are shown
+    int handlerDeadline;  // Until a batch handler is cancelled, from its enqueueing
+    int queryDeadline;    // Until all batch handlers are cancelled, from the query start
+};
+
+
 /**
  * @brief The QueryExecution class
- * Represents the execution of a query
+ * Represents the execution of a query. If the batch handlers did not finish
+ * within the batch latency budget (milliseconds), the results gathered so far
+ * are shown and the results of the handlers finishing later are merged into
+ * the sorted rows.
+ *
+ * Every handler gets a query of its own. A batch handler running past its
+ * deadline or the query deadline is cancelled by invalidating its query, the
+ * matches it added so far are kept. Realtime handlers are only cancelled with
+ * the execution. The execution does not wait for cancelled handlers
+ * and their threads stop counting against the thread pool.
+ *
+ * The handlers run on the thread pool of the query manager, at the priority
+ * the query manager passes. Queued handlers of cancelled executions are
+ * skipped.
  */
 class QueryExecution : public QAbstractListModel
 {
@@ -45,8 +71,11 @@ public:
     QueryExecution(const std::set<QueryHandler*> &,
                    const std::set<FallbackProvider*> &,
                    const QString &queryString,
-                   std::map<QString,uint> scores,
-                   bool fetchIncrementally);
+                   std::shared_ptr<const std::map<QString,uint>> scores,
+                   bool fetchIncrementally,
+                   QueryBudgets budgets,
+                   QThreadPool *threadPool,
+                   int priority);
     ~QueryExecution() override;
 
     const State &state() const;
@@ -68,16 +97,26 @@ public:
 
 private:
 
+    struct HandlerRun;
+
     void setState(State state);
 
+    void runHandlers(const std::set<QueryHandler*> &handlers, const char *label);
+    void releaseThread(HandlerRun &run);
+    void onHandlerFinished(int index);
+    void onDeadlineTimeout();
+    void onHandlerRunsEnded();
+    std::vector<std::pair<std::shared_ptr<Item>, uint>> takePendingResults();
+
     void runBatchHandlers();
+    void onBatchLatencyBudgetExpired();
     void onBatchHandlersFinished();
+    void takeBatchResults();
+    void mergePendingResults();
     void runRealtimeHandlers();
     void onRealtimeHandlersFinsished();
     void insertPendingResults();
 
-    bool isValid_ = true;
-
     Query query_;
     State state_;
 
@@ -88,11 +127,21 @@ private:
     mutable std::vector<std::pair<std::shared_ptr<Item>, uint>> fallbacks_;
     mutable int sortedItems_ = 0;
     bool fetchIncrementally_ = false;
+    bool resultsShown_ = false;
+
+    QueryBudgets budgets_;
+    QThreadPool *threadPool_;
+    int priority_;
+    std::vector<std::shared_ptr<HandlerRun>> runs_;
+    int pendingRuns_ = 0;
+    bool runningRealtime_ = false;
 
     QTimer fiftyMsTimer_;
+    QTimer batchLatencyTimer_;
+    QTimer deadlineTimer_;
 
-    QFuture<std::pair<QueryHandler*,uint>> future_;
-    QFutureWatcher<std::pair<QueryHandler*,uint>> futureWatcher_;
+    QFuture<uint> future_;
+    QFutureWatcher<uint> futureWatcher_;
 
 signals:
 
@@ -9,6 +9,7 @@
 #include <QSqlQuery>
 #include <QSqlRecord>
 #include <QStandardPaths>
+#include <QThread>
 #include <chrono>
 #include <vector>
 #include "albert/extension.h"
@@ -26,12 +27,22 @@ using namespace std::chrono;
 namespace {
 const char* CFG_INCREMENTAL_SORT = "incrementalSort";
 const bool  DEF_INCREMENTAL_SORT = false;
+const char* CFG_BATCH_LATENCY_BUDGET = "batchLatencyBudget";
+const int   DEF_BATCH_LATENCY_BUDGET = 100;
+const char* CFG_HANDLER_DEADLINE = "handlerDeadline";
+const int   DEF_HANDLER_DEADLINE = 1000;
+const char* CFG_QUERY_DEADLINE = "queryDeadline";
+const int   DEF_QUERY_DEADLINE = 2000;
+const char* CFG_THREAD_COUNT = "queryThreadCount";
+const int   SHUTDOWN_TIMEOUT = 1000;
 }
 
 /** ***************************************************************************/
 Core::QueryManager::QueryManager(ExtensionManager* em, QObject *parent)
     : QObject(parent),
-      extensionManager_(em) {
+      extensionManager_(em),
+      threadPool_(new QThreadPool),
+      lastPriority_(0) {
 
     QSqlQuery q;
 
@@ -55,12 +66,28 @@ Core::QueryManager::QueryManager(ExtensionManager* em, QObject *parent)
 
     QSettings s(qApp->applicationName());
     incrementalSort_ = s.value(CFG_INCREMENTAL_SORT, DEF_INCREMENTAL_SORT).toBool();
+    batchLatencyBudget_ = s.value(CFG_BATCH_LATENCY_BUDGET, DEF_BATCH_LATENCY_BUDGET).toInt();
+    handlerDeadline_ = s.value(CFG_HANDLER_DEADLINE, DEF_HANDLER_DEADLINE).toInt();
+    queryDeadline_ = s.value(CFG_QUERY_DEADLINE, DEF_QUERY_DEADLINE).toInt();
+    threadPool_->setMaxThreadCount(s.value(CFG_THREAD_COUNT, QThread::idealThreadCount()).toInt());
 }
 
 
-/** ***************************************************************************/
+/** ***************************************************************************
+ * @brief Waits a while for the running handlers. Handlers ignoring their
+ * cancellation must not block the exit, the pool and its threads are left to
+ * the process then.
+ */
 QueryManager::~QueryManager() {
 
+    for ( QueryExecution *query : pastQueries_ )
+        if ( query->state() == QueryExecution::State::Running )
+            query->cancel();
+
+    if ( threadPool_->waitForDone(SHUTDOWN_TIMEOUT) )
+        delete threadPool_;
+    else
+        qWarning() << "Query handlers did not finish on exit, leaving their threads behind";
 }
 
 
@@ -165,6 +192,9 @@ void Core::QueryManager::teardownSession() {
             delete query;
     pastQueries_.clear();
 
+    // The queued handlers of the past queries are skipped, start over
+    lastPriority_ = 0;
+
     // Compute new match rankings
     updateScores();
 
@@ -193,7 +223,12 @@ void Core::QueryManager::startQuery(const QString &searchTerm) {
                                                       extensionManager_->fallbackProviders(),
                                                       searchTerm,
                                                       scores_,
-                                                      incrementalSort_);
+                                                      incrementalSort_,
+                                                      {batchLatencyBudget_,
+                                                       handlerDeadline_,
+                                                       queryDeadline_},
+                                                      threadPool_,
+                                                      ++lastPriority_);
     connect(currentQuery, &QueryExecution::resultsReady, this, &QueryManager::resultsReady);
     currentQuery->run();
 
@@ -207,7 +242,7 @@ void Core::QueryManager::startQuery(const QString &searchTerm) {
     pastQueries_.emplace_back(currentQuery);
 
     long duration = duration_cast<microseconds>(system_clock::now()-start).count();
-    qDebug() << qPrintable(QString("TIME: %1 µs SESSION TEARDOWN OVERALL").arg(duration, 6));
+    qDebug() << qPrintable(QString("TIME: %1 µs QUERY STARTED").arg(duration, 6));
 }
 
 
@@ -224,6 +259,58 @@ void QueryManager::setIncrementalSort(bool value){
 }
 
 
+/** ***************************************************************************/
+int QueryManager::batchLatencyBudget(){
+    return batchLatencyBudget_;
+}
+
+
+/** ***************************************************************************/
+void QueryManager::setBatchLatencyBudget(int milliseconds){
+    QSettings(qApp->applicationName()).setValue(CFG_BATCH_LATENCY_BUDGET, milliseconds);
+    batchLatencyBudget_ = milliseconds;
+}
+
+
+/** ***************************************************************************/
+int QueryManager::handlerDeadline(){
+    return handlerDeadline_;
+}
+
+
+/** ***************************************************************************/
+void QueryManager::setHandlerDeadline(int milliseconds){
+    QSettings(qApp->applicationName()).setValue(CFG_HANDLER_DEADLINE, milliseconds);
+    handlerDeadline_ = milliseconds;
+}
+
+
+/** ***************************************************************************/
+int QueryManager::queryDeadline(){
+    return queryDeadline_;
+}
+
+
+/** ***************************************************************************/
+void QueryManager::setQueryDeadline(int milliseconds){
+    QSettings(qApp->applicationName()).setValue(CFG_QUERY_DEADLINE, milliseconds);
+    queryDeadline_ = milliseconds;
+}
+
+
+/** ***************************************************************************/
+int QueryManager::threadCount(){
+    return threadPool_->maxThreadCount();
+}
+
+
+/** ***************************************************************************/
+void QueryManager::setThreadCount(int count){
+    QSettings(qApp->applicationName()).setValue(CFG_THREAD_COUNT, count);
+    threadPool_->setMaxThreadCount(count);
+}
+
+
 /** ***************************************************************************
  * @brief Core::MatchCompare::update
  * Update the usage score:
@@ -233,7 +320,7 @@ void QueryManager::setIncrementalSort(bool value){
  */
 void QueryManager::updateScores()
 {
-    scores_.clear();
+    auto scores = make_shared<map<QString,uint>>();
     QSqlQuery query("SELECT a.item_id AS id, SUM(1/(julianday('now')-julianday(timestamp, 'unixepoch')+1)) AS score "
                     "FROM activation a JOIN  query q ON a.query_id = q.id "
                     "WHERE a.item_id<>'' "
@@ -242,7 +329,8 @@ void QueryManager::updateScores()
     if ( query.next() ){
         double max = query.value(1).toDouble();
         do {
-            scores_.emplace(query.value(0).toString(), static_cast<uint>(query.value(1).toDouble()*UINT_MAX/max));
+            scores->emplace(query.value(0).toString(), static_cast<uint>(query.value(1).toDouble()*UINT_MAX/max));
         } while (query.next());
     }
+    scores_ = move(scores);
 }
@@ -3,8 +3,10 @@
 #pragma once
 #include <QObject>
 #include <QAbstractItemModel>
-#include <memory>
+#include <QThreadPool>
 #include <list>
+#include <map>
+#include <memory>
 
 namespace Core {
 
@@ -27,6 +29,18 @@ public:
     bool incrementalSort();
     void setIncrementalSort(bool value);
 
+    int batchLatencyBudget();
+    void setBatchLatencyBudget(int milliseconds);
+
+    int handlerDeadline();
+    void setHandlerDeadline(int milliseconds);
+
+    int queryDeadline();
+    void setQueryDeadline(int milliseconds);
+
+    int threadCount();
+    void setThreadCount(int count);
+
 private:
 
     void updateScores();
@@ -34,7 +48,12 @@ private:
     ExtensionManager *extensionManager_;
     std::list<QueryExecution*> pastQueries_;
     bool incrementalSort_;
-    std::map<QString,uint> scores_;
+    int batchLatencyBudget_;
+    int handlerDeadline_;
+    int queryDeadline_;
+    QThreadPool *threadPool_;  // Runs the query handlers only, left behind if they hang on exit
+    int lastPriority_;         // Of the handlers of the last query, later queries run first
+    std::shared_ptr<const std::map<QString,uint>> scores_;
     std::map<QString, unsigned long long> handlerIds_;
     unsigned long long lastQueryId_;
 
@@ -0,0 +1,97 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#pragma once
+#include <QtGlobal>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace Core {
+
+class Item;
+
+/**
+ * @brief The ResultBuffer class
+ * The matches a single thread added to a query. The thread appends and the
+ * query execution takes the matches appended so far, neither takes a lock.
+ * The matches are stored in linked chunks, appending never moves a match.
+ */
+class ResultBuffer
+{
+public:
+
+    explicit ResultBuffer(std::thread::id thread) : thread_(thread) {
+        head_ = tail_ = new Chunk;
+    }
+
+    ~ResultBuffer() {
+        while (head_) {
+            Chunk *next = head_->next.load(std::memory_order_relaxed);
+            delete head_;
+            head_ = next;
+        }
+    }
+
+    ResultBuffer(const ResultBuffer &) = delete;
+    ResultBuffer &operator=(const ResultBuffer &) = delete;
+
+    /** The thread appending to the buffer */
+    std::thread::id thread() const { return thread_; }
+
+    /** The buffer of the next thread of the query */
+    ResultBuffer *next = nullptr;
+
+    /** Appends a match, called by the owning thread only */
+    template<typename T>
+    void append(T &&item, uint score) {
+        if (tailCount_ == CHUNK_SIZE) {
+            Chunk *chunk = new Chunk;
+            tail_->next.store(chunk, std::memory_order_release);
+            tail_ = chunk;
+            tailCount_ = 0;
+        }
+        tail_->matches[tailCount_] = std::make_pair(std::forward<T>(item), score);
+        tail_->count.store(++tailCount_, std::memory_order_release);
+    }
+
+    /** Moves the matches appended since the last call to out, called by a single thread */
+    void take(std::vector<std::pair<std::shared_ptr<Item>, uint>> &out) {
+        for (;;) {
+            uint count = head_->count.load(std::memory_order_acquire);
+            for (; taken_ < count; ++taken_)
+                out.push_back(std::move(head_->matches[taken_]));
+            if (count < CHUNK_SIZE)
+                return;
+
+            // The appending thread left a chunk for good once it linked the next
+            Chunk *next = head_->next.load(std::memory_order_acquire);
+            if (!next)
+                return;
+            delete head_;
+            head_ = next;
+            taken_ = 0;
+        }
+    }
+
+private:
+
+    static constexpr uint CHUNK_SIZE = 256;
+
+    struct Chunk {
+        std::array<std::pair<std::shared_ptr<Item>, uint>, CHUNK_SIZE> matches;
+        std::atomic<uint> count{0};
+        std::atomic<Chunk*> next{nullptr};
+    };
+
+    const std::thread::id thread_;
+    Chunk *head_;         // Taking thread
+    uint taken_ = 0;
+    Chunk *tail_;         // Appending thread
+    uint tailCount_ = 0;
+
+};
+
+}
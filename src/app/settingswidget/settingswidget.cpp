@@ -10,6 +10,7 @@
 #include <QMessageBox>
 #include <QSettings>
 #include <QShortcut>
+#include <QSpinBox>
 #include <QSqlQuery>
 #include <QStandardPaths>
 #include <vector>
@@ -89,6 +90,24 @@ Core::SettingsWidget::SettingsWidget(ExtensionManager *extensionManager,
     connect(ui.checkBox_incrementalSort, &QCheckBox::toggled,
             queryManager_, &QueryManager::setIncrementalSort);
 
+    // LATENCY BUDGET
+    ui.spinBox_latencyBudget->setValue(queryManager_->batchLatencyBudget());
+    connect(ui.spinBox_latencyBudget, static_cast<void(QSpinBox::*)(int)>(&QSpinBox::valueChanged),
+            queryManager_, &QueryManager::setBatchLatencyBudget);
+
+    // DEADLINES
+    ui.spinBox_handlerDeadline->setValue(queryManager_->handlerDeadline());
+    connect(ui.spinBox_handlerDeadline, static_cast<void(QSpinBox::*)(int)>(&QSpinBox::valueChanged),
+            queryManager_, &QueryManager::setHandlerDeadline);
+    ui.spinBox_queryDeadline->setValue(queryManager_->queryDeadline());
+    connect(ui.spinBox_queryDeadline, static_cast<void(QSpinBox::*)(int)>(&QSpinBox::valueChanged),
+            queryManager_, &QueryManager::setQueryDeadline);
+
+    // THREAD COUNT
+    ui.spinBox_threadCount->setValue(queryManager_->threadCount());
+    connect(ui.spinBox_threadCount, static_cast<void(QSpinBox::*)(int)>(&QSpinBox::valueChanged),
+            queryManager_, &QueryManager::setThreadCount);
+
     // TELEMETRY
     ui.checkBox_telemetry->setChecked(telemetry_->isEnabled());
     connect(ui.checkBox_telemetry, &QCheckBox::toggled, this, [this](bool checked){ telemetry_->enable(checked); });
@@ -1,103 +1,152 @@
 // Copyright (C) 2014-2018 Manuel Schneider
 
-#include <QRegularExpression>
+#include <algorithm>
+#include <array>
+#include <numeric>
 #include "fuzzysearch.h"
-#include "indexable.h"
-#include "prefixsearch.h"
-using std::map;
-using std::set;
+#include "indexfile.h"
+#include "prefixeditdistance.h"
+#include "searchbase.h"
 using std::pair;
-using std::shared_ptr;
 using std::vector;
 
-namespace {
-
-bool checkPrefixEditDistance(const QString &prefix, const QString &str, uint delta) {
-    uint n = prefix.size() + 1;
-    uint m = std::min(prefix.size() + delta + 1, static_cast<uint>(str.size()) + 1);
-
-    uint* matrix = new uint[n*m];
-
-    // Initialize left and top row.
-    for (uint i = 0; i < n; ++i) { matrix[i*m+0] = i; }
-    for (uint i = 0; i < m; ++i) { matrix[0*m+i] = i; }
-
-    // Now fill the whole matrix.
-    for (uint i = 1; i < n; ++i) {
-        for (uint j = 1; j < m; ++j) {
-            uint dia = matrix[(i-1)*m+j-1] + (prefix[i-1] == str[j-1] ? 0 : 1);
-            matrix[i*m+j] = std::min(std::min(
-                                         dia,
-                                         matrix[i*m+j-1] + 1),
-                    matrix[(i-1)*m+j] + 1);
-        }
-    }
-
-    // Check the last row if there is an entry <= delta.
-    bool result = false;
-    for (uint j = 0; j < m; ++j) {
-        if (matrix[(n-1)*m+j] <= delta) {
-            result = true;
-            break;
-        }
-    }
-    delete[] matrix;
-    return result;
-}
+/** ***************************************************************************/
+Core::FuzzySearch::FuzzySearch(uint q, double d)
+    : qGramOffsets_(vector<uint32_t>(1, 0)), q_(q), delta_(d) {
 
 }
 
 
 
 /** ***************************************************************************/
-Core::FuzzySearch::FuzzySearch(uint q, double d) : q_(q), delta_(d) {
+Core::FuzzySearch::~FuzzySearch() {
 
 }
 
 
 
 /** ***************************************************************************/
-Core::FuzzySearch::FuzzySearch(const Core::PrefixSearch &rhs, uint q, double d)
-    : PrefixSearch(rhs), q_(q), delta_(d) {
-    // Iterate over the inverted index and build the qGramindex
-    for ( const std::pair<QString,std::set<uint>> &invertedIndexEntry : invertedIndex_ ) {
-        QString spaced = QString(q_-1,' ').append(invertedIndexEntry.first);
-        for (uint i = 0 ; i < static_cast<uint>(invertedIndexEntry.first.size()); ++i)
-            ++qGramIndex_[spaced.mid(i,q_)][invertedIndexEntry.first];
-    }
-}
-
+void Core::FuzzySearch::add(const QString &term) {
 
+    if (wordIds_.contains(term))
+        return;
 
-/** ***************************************************************************/
-Core::FuzzySearch::~FuzzySearch() {
+    uint32_t id = static_cast<uint32_t>(words_.size());
+    words_.push_back(term);
+    wordLengths_.push_back(static_cast<uint32_t>(term.size()));
+    wordIds_.insert(term, id);
 
+    // Build a qGram index (map qGram to word and position)
+    vector<uint64_t> keys;
+    qGrams(term, keys);
+    for (uint32_t i = 0; i < static_cast<uint32_t>(keys.size()); ++i)
+        qGramIndex_[keys[i]].push_back({id, i});
 }
 
 
 
-/** ***************************************************************************/
-void Core::FuzzySearch::add(const std::shared_ptr<IndexableItem> &indexable) {
+/** ***************************************************************************
+ * @brief Bulk loads the terms. The qGrams of the new words are generated in
+ * parallel chunks, sorted by key, and merged into the qGram table.
+ */
+void Core::FuzzySearch::build(const vector<QString> &terms) {
 
-    // Add indexable to the index
-    index_.push_back(indexable);
-    uint id = static_cast<uint>(index_.size()-1);
+    uint32_t first = static_cast<uint32_t>(words_.size());
+    for (const QString &term : terms) {
+        if (!wordIds_.contains(term)) {
+            wordIds_.insert(term, static_cast<uint32_t>(words_.size()));
+            wordLengths_.push_back(static_cast<uint32_t>(term.size()));
+            words_.push_back(term);
+        }
+    }
 
-    // Add a mappings to the inverted index which maps on t.
-    vector<IndexableItem::IndexString> indexStrings = indexable->indexStrings();
-    for (const auto &idxStr : indexStrings) {
-        set<QString> words = splitString(idxStr.string);
-        for (const QString &w : words) {
+    size_t count = words_.size() - first;
+    size_t chunks = SearchBase::parallelChunks(count);
+    vector<vector<pair<uint64_t,QGramPosting>>> runs(chunks);
+    SearchBase::parallelFor(chunks, [&](size_t c){
+        vector<uint64_t> keys;
+        vector<pair<uint64_t,QGramPosting>> &run = runs[c];
+        for (size_t w = first + count * c / chunks; w < first + count * (c + 1) / chunks; ++w) {
+            qGrams(words_[w], keys);
+            for (uint32_t i = 0; i < static_cast<uint32_t>(keys.size()); ++i)
+                run.emplace_back(keys[i], QGramPosting{static_cast<uint32_t>(w), i});
+        }
+        std::sort(run.begin(), run.end(), [](const pair<uint64_t,QGramPosting> &l,
+                                             const pair<uint64_t,QGramPosting> &r){
+            return l.first < r.first;
+        });
+    });
+
+    for (const auto &run : runs) {
+        for (auto it = run.cbegin(); it != run.cend();) {
+            vector<QGramPosting> &postings = qGramIndex_[it->first];
+            uint64_t key = it->first;
+            for (; it != run.cend() && it->first == key; ++it)
+                postings.push_back(it->second);
+        }
+    }
+
+    freeze();
+}
 
-            // Add word to inverted index (map word to item)
-            this->invertedIndex_[w].insert(id);
 
-            // Build a qGram index (map substring to word)
-            QString spaced = QString(q_-1,' ').append(w);
-            for (uint i = 0 ; i < static_cast<uint>(w.size()); ++i)
-                ++qGramIndex_[spaced.mid(i,q_)][w]; //FIXME Currently occurences are not uses
+
+/** ***************************************************************************
+ * @brief Merges the qGrams of the words added since the last build into the
+ * flat qGram table.
+ */
+void Core::FuzzySearch::freeze() {
+
+    if (qGramIndex_.empty())
+        return;
+
+    vector<uint64_t> staged;
+    staged.reserve(qGramIndex_.size());
+    for (const auto &entry : qGramIndex_)
+        staged.push_back(entry.first);
+    std::sort(staged.begin(), staged.end());
+
+    size_t postingCount = qGramPostings_.size();
+    for (const auto &entry : qGramIndex_)
+        postingCount += entry.second.size();
+
+    vector<uint64_t> keys;
+    vector<uint32_t> offsets{0};
+    vector<QGramPosting> postings;
+    keys.reserve(qGramKeys_.size() + staged.size());
+    offsets.reserve(qGramKeys_.size() + staged.size() + 1);
+    postings.reserve(postingCount);
+
+    // Merge the sorted keys of the table and the staged ones
+    size_t i = 0, j = 0;
+    while (i < qGramKeys_.size() || j < staged.size()) {
+        uint64_t key = (j == staged.size() || (i < qGramKeys_.size() && qGramKeys_[i] <= staged[j]))
+                ? qGramKeys_[i] : staged[j];
+        size_t begin = postings.size();
+        if (i < qGramKeys_.size() && qGramKeys_[i] == key) {
+            postings.insert(postings.end(), qGramPostings_.begin() + qGramOffsets_[i],
+                            qGramPostings_.begin() + qGramOffsets_[i+1]);
+            ++i;
+        }
+        if (j < staged.size() && staged[j] == key) {
+            const vector<QGramPosting> &list = qGramIndex_[key];
+            postings.insert(postings.end(), list.begin(), list.end());
+            ++j;
         }
+
+        // Sort the postings by position to look up position windows
+        std::sort(postings.begin() + static_cast<long>(begin), postings.end(),
+                  [](const QGramPosting &l, const QGramPosting &r){
+            return l.position < r.position || (l.position == r.position && l.word < r.word);
+        });
+        keys.push_back(key);
+        offsets.push_back(static_cast<uint32_t>(postings.size()));
     }
+
+    qGramKeys_ = MappedArray<uint64_t>(std::move(keys));
+    qGramOffsets_ = MappedArray<uint32_t>(std::move(offsets));
+    qGramPostings_ = MappedArray<QGramPosting>(std::move(postings));
+    qGramIndex_.clear();
 }
 
 
@@ -105,128 +154,236 @@ void Core::FuzzySearch::add(const std::shared_ptr<IndexableItem> &indexable) {
 /** ***************************************************************************/
 void Core::FuzzySearch::clear() {
     qGramIndex_.clear();
-    invertedIndex_.clear();
-    index_.clear();
+    qGramKeys_ = MappedArray<uint64_t>();
+    qGramOffsets_ = MappedArray<uint32_t>(vector<uint32_t>(1, 0));
+    qGramPostings_ = MappedArray<QGramPosting>();
+    wordIds_.clear();
+    wordLengths_.clear();
+    words_.clear();
 }
 
 
 /** ***************************************************************************/
-vector<shared_ptr<Core::IndexableItem> > Core::FuzzySearch::search(const QString &query) const {
+void Core::FuzzySearch::save(IndexWriter &writer) const {
 
-    // Make words unique, lower and prefixfree
-    set<QString> words = splitString(query);
+    vector<QChar> wordChars;
+    vector<uint32_t> wordOffsets{0};
+    for (const QString &word : words_) {
+        wordChars.insert(wordChars.end(), word.cbegin(), word.cend());
+        wordOffsets.push_back(static_cast<uint32_t>(wordChars.size()));
+    }
 
-    // Quit if there are no words in query
-    if (words.empty())
-        return vector<shared_ptr<IndexableItem>>();
+    writer.write(&q_, sizeof(q_));
+    writer.write(&delta_, sizeof(delta_));
+    writer.write(wordChars);
+    writer.write(wordOffsets);
+    writer.write(qGramKeys_);
+    writer.write(qGramOffsets_);
+    writer.write(qGramPostings_);
+}
 
-    vector<map<uint,uint>> resultsPerWord; // id, count
-    for ( const QString &word : words ) {
 
-        uint delta = static_cast<uint>((delta_ < 1)? (word.size()-1)*delta_ : delta_);
 
-        // Generate the qGrams of this word
-        map<QString,uint> qGrams;
-        QString spaced(q_-1,' ');
-        spaced.append(word);
-        for ( uint i = 0; i < static_cast<uint>(word.size()); ++i )
-            ++qGrams[spaced.mid(i,q_)];
+/** ***************************************************************************
+ * @brief Reads the layer, the qGram table is used in place
+ */
+bool Core::FuzzySearch::load(IndexReader &reader) {
+
+    clear();
+
+    vector<uint> q;
+    vector<double> delta;
+    MappedArray<QChar> wordChars;
+    MappedArray<uint32_t> wordOffsets;
+    MappedArray<uint64_t> keys;
+    MappedArray<uint32_t> offsets;
+    MappedArray<QGramPosting> postings;
+    if (!reader.read(q) || !reader.read(delta) || !reader.read(wordChars) || !reader.read(wordOffsets)
+            || !reader.read(keys) || !reader.read(offsets) || !reader.read(postings)
+            || q.size() != 1 || delta.size() != 1 || wordOffsets.empty()
+            || wordOffsets[wordOffsets.size() - 1] != wordChars.size()
+            || offsets.size() != keys.size() + 1 || offsets[keys.size()] != postings.size())
+        return false;
+
+    for (uint32_t w = 0; w + 1 < wordOffsets.size(); ++w) {
+        if (wordOffsets[w] > wordOffsets[w+1] || wordOffsets[w+1] > wordChars.size()) {
+            clear();
+            return false;
+        }
+        QString word(wordChars.data() + wordOffsets[w], static_cast<int>(wordOffsets[w+1] - wordOffsets[w]));
+        wordIds_.insert(word, w);
+        wordLengths_.push_back(static_cast<uint32_t>(word.size()));
+        words_.push_back(std::move(word));
+    }
 
-        // Get the words referenced by each qGram and count the references
-        map<QString,uint> wordMatches;
-        for ( const pair<QString,uint> &qGram : qGrams ) {
+    // Every posting has to point to a qGram of a loaded word
+    for (size_t k = 0; k < keys.size(); ++k)
+        if (offsets[k] > offsets[k+1]) {
+            clear();
+            return false;
+        }
+    for (const QGramPosting &p : postings)
+        if (p.word >= words_.size() || p.position >= wordLengths_[p.word]) {
+            clear();
+            return false;
+        }
+
+    q_ = q.front();
+    delta_ = delta.front();
+    qGramKeys_ = std::move(keys);
+    qGramOffsets_ = std::move(offsets);
+    qGramPostings_ = std::move(postings);
+    return true;
+}
 
-            // Find the qGram in the index, skip if nothing found
-            decltype(qGramIndex_)::const_iterator qGramIndexIt = qGramIndex_.find(qGram.first);
-            if ( qGramIndexIt == qGramIndex_.end() )
-                continue;
 
-            // Iterate over the set of words referenced by this qGram
-            for (const pair<QString,uint> &indexEntry : qGramIndexIt->second) {
-                // CRUCIAL: The match can contain only the commom amount of qGrams
-                wordMatches[indexEntry.first] += std::min(qGram.second, indexEntry.second);
-            }
-        }
 
-        // Unite the items referenced by the words accumulating their #matches
-        map<uint,uint> results; // id, count
-        for (const pair<QString,uint> &wordMatch : wordMatches) {
-
-            /*
-             * Do some kind of (cheap) preselection by mathematical bound
-             * If the matched word has less than |word|-δ*q matching qGrams
-             * it cannot be a match.
-             * This is because a single error can reduce the common qGram by
-             * maximum q. δ errors can therefore reduce the common qGrams by
-             * maximum δ*q. If the common qGrams are less than |word|-δ*q this
-             * implies that there are more errors than δ.
-             */
-            if (wordMatch.second < (word.size()-delta*q_) )
-                continue;
-
-            // Now check the (expensive) prefix edit distance
-            if (!checkPrefixEditDistance(word, wordMatch.first, delta))
-                continue;
-
-            // Checks should not be neccessary since this builds on the index
-            for(uint id : invertedIndex_.at(wordMatch.first)) {
-                results[id] += wordMatch.second;
+/** ***************************************************************************/
+void Core::FuzzySearch::match(const QString &word, vector<uint32_t> &terms) const {
+
+    terms.clear();
+
+    // Scratch buffers, reused by the queries running in this thread. The
+    // counters of the touched words are reset after each word.
+    thread_local vector<uint32_t> counters;
+    thread_local vector<uint32_t> counted;
+    thread_local vector<uint32_t> touched;
+    thread_local vector<uint64_t> keys;
+    counters.resize(words_.size(), 0);
+    counted.resize(words_.size(), 0);
+
+    uint delta = static_cast<uint>((delta_ < 1)? (word.size()-1)*delta_ : delta_);
+    PrefixEditDistance prefixEditDistance(word);
+
+    // Generate the qGrams of this word
+    qGrams(word, keys);
+
+    /*
+     * Do some kind of (cheap) preselection by mathematical bound
+     * If the matched word has less than |word|-δ*q matching qGrams
+     * it cannot be a match.
+     * This is because a single error can reduce the common qGram by
+     * maximum q. δ errors can therefore reduce the common qGrams by
+     * maximum δ*q. If the common qGrams are less than |word|-δ*q this
+     * implies that there are more errors than δ.
+     */
+    const int minMatches = word.size() - static_cast<int>(delta*q_);
+
+    touched.clear();
+    if (minMatches <= 0) {
+        // δ errors can destroy all qGrams, every word is a candidate
+        touched.resize(words_.size());
+        std::iota(touched.begin(), touched.end(), 0);
+    } else {
+        /*
+         * Count the qGrams of the query the words have in common. A qGram at
+         * position i can only be preserved at positions i-δ to i+δ in a word
+         * that is within δ edits, so only these positions count. Each qGram
+         * of the query is counted once per word.
+         */
+        for (uint32_t i = 0; i < static_cast<uint32_t>(keys.size()); ++i) {
+
+            const uint32_t first = (i > delta) ? i - delta : 0, last = i + delta;
+            auto count = [i](uint32_t w){
+                if (counters[w] == 0)
+                    touched.push_back(w);
+                if (counted[w] != i + 1) {
+                    counted[w] = i + 1;
+                    ++counters[w];
+                }
+            };
+
+            // Look up the window in the sorted postings of the qGram table
+            auto key = std::lower_bound(qGramKeys_.begin(), qGramKeys_.end(), keys[i]);
+            if (key != qGramKeys_.end() && *key == keys[i]) {
+                size_t k = static_cast<size_t>(key - qGramKeys_.begin());
+                const QGramPosting *end = qGramPostings_.begin() + qGramOffsets_[k+1];
+                const QGramPosting *it = std::lower_bound(qGramPostings_.begin() + qGramOffsets_[k], end, first,
+                                                          [](const QGramPosting &p, uint32_t pos){ return p.position < pos; });
+                for (; it != end && it->position <= last; ++it)
+                    count(it->word);
             }
-        }
 
-        resultsPerWord.push_back(std::move(results));
+            // Scan the postings of the words added since
+            auto staged = qGramIndex_.find(keys[i]);
+            if (staged != qGramIndex_.end())
+                for (const QGramPosting &p : staged->second)
+                    if (first <= p.position && p.position <= last)
+                        count(p.word);
+        }
     }
 
-    // Intersect the set of items references by the (referenced) words
-    // This assusmes that there is at least one word (the query would not have
-    // been started elsewise)
-    vector<pair<uint,uint>> finalResult;
-    if (resultsPerWord.size() > 1) {
-        // Get the smallest list for intersection (performance)
-        uint smallest=0;
-        for (uint i = 1; i < static_cast<uint>(resultsPerWord.size()); ++i)
-            if (resultsPerWord[i].size() < resultsPerWord[smallest].size())
-                smallest = i;
-
-        bool allResultsContainEntry;
-        for (map<uint,uint>::const_iterator r = resultsPerWord[smallest].begin();
-             r != resultsPerWord[smallest].cend(); ++r) {
-            // Check if all results contain this entry
-            allResultsContainEntry=true;
-            uint accMatches = resultsPerWord[smallest][r->first];
-            for (uint i = 0; i < static_cast<uint>(resultsPerWord.size()); ++i) {
-                // Ignore itself
-                if (i==smallest)
-                    continue;
-
-                // If it is in: check next relutlist
-                if (resultsPerWord[i].find(r->first) != resultsPerWord[i].end() ) {
-                    // Accumulate matches
-                    accMatches += resultsPerWord[i][r->first];
-                    continue;
-                }
+    // Keep the words within the error tolerance
+    for (uint32_t w : touched) {
+        uint32_t matches = counters[w];
+        counters[w] = 0;
+        counted[w] = 0;
 
-                allResultsContainEntry = false;
-                break;
-            }
+        // A word shorter than |word|-δ has no prefix within δ edits
+        if (wordLengths_[w] + delta < static_cast<uint>(word.size()))
+            continue;
 
-            // If this is not common, check the next entry
-            if (!allResultsContainEntry)
-                continue;
+        if (static_cast<int>(matches) < minMatches)
+            continue;
 
-            // Finally this match is common an can be put into the results
-            finalResult.emplace_back(r->first, accMatches);
-        }
-    } else {// Else do it without intersction
-        for ( const pair<uint,uint> &result : resultsPerWord[0] )
-            finalResult.emplace_back(result.first, result.second);
-    }
+        // Now check the (expensive) prefix edit distance
+        if (!prefixEditDistance(words_[w], delta))
+            continue;
 
-    vector<shared_ptr<IndexableItem>> result;
-    for (const pair<uint,uint> &pair : finalResult) {
-        result.emplace_back(index_.at(pair.first));
+        terms.push_back(w);
     }
-    return result;
 }
 
 
+
+/** ***************************************************************************
+ * @brief The prefix edit distance never decreases when the word is extended,
+ * but the error tolerance may grow with the length of the word.
+ */
+bool Core::FuzzySearch::extends(const QString &word, const QString &extension) const {
+    uint delta = static_cast<uint>((delta_ < 1)? (word.size()-1)*delta_ : delta_);
+    uint extensionDelta = static_cast<uint>((delta_ < 1)? (extension.size()-1)*delta_ : delta_);
+    return extension.startsWith(word) && delta == extensionDelta;
+}
+
+
+
+/** ***************************************************************************
+ * @brief A term within the error tolerance matches by the share of the term
+ * the word covers, reduced by the prefix edit distance. Exact prefixes match
+ * like in the prefix search.
+ */
+std::function<double(const QString &)> Core::FuzzySearch::matchQuality(const QString &word) const {
+    uint delta = static_cast<uint>((delta_ < 1)? (word.size()-1)*delta_ : delta_);
+    auto prefixEditDistance = std::make_shared<PrefixEditDistance>(word);
+    return [word, delta, prefixEditDistance](const QString &term){
+        uint distance = prefixEditDistance->distance(term, delta);
+        if (distance > delta)
+            return 0.0;
+        double coverage = std::min(1.0, static_cast<double>(word.size()) / term.size());
+        return coverage * (word.size() + 1 - distance) / (word.size() + 1);
+    };
+}
+
+
+
+/** ***************************************************************************
+ * @brief Computes the qGrams of the word, padded by q-1 spaces in front.
+ * Up to four UTF-16 units are packed into the 64 bit keys losslessly, longer
+ * qGrams are hashed. Collisions only weaken the count filter.
+ */
+void Core::FuzzySearch::qGrams(const QString &word, vector<uint64_t> &keys) const {
+    keys.clear();
+    const QChar *chars = word.unicode();
+    for (int i = 0; i < word.size(); ++i) {
+        uint64_t key = (q_ > 4) ? 14695981039346656037ULL : 0;
+        for (int j = i - static_cast<int>(q_) + 1; j <= i; ++j) {
+            ushort c = (j < 0) ? ushort(' ') : chars[j].unicode();
+            if (q_ > 4)
+                key = (key ^ c) * 1099511628211ULL;
+            else
+                key = (key << 16) | c;
+        }
+        keys.push_back(key);
+    }
+}
@@ -1,32 +1,68 @@
 // Copyright (C) 2014-2018 Manuel Schneider
 
 #pragma once
+#include <QHash>
 #include <QString>
-#include <map>
-#include <memory>
+#include <cstdint>
+#include <unordered_map>
 #include <vector>
-#include "prefixsearch.h"
+#include "mappedarray.h"
+#include "searchlayer.h"
 
 namespace Core {
 
-class FuzzySearch final : public PrefixSearch
+/**
+ * @brief The FuzzySearch class
+ * A layer matching terms within an error tolerance, measured by the prefix
+ * edit distance. Candidate terms are found by the qGrams they share with the
+ * query word.
+ */
+class FuzzySearch final : public SearchLayer
 {
 public:
 
     explicit FuzzySearch(uint q = 3, double d = 1.0/3);
-    explicit FuzzySearch(const PrefixSearch& rhs, uint q = 3, double d = 1.0/3);
     ~FuzzySearch();
 
-    void add(const std::shared_ptr<IndexableItem> &idxble) override;
+    Type type() const override { return Type::Fuzzy; }
+    void add(const QString &term) override;
+    void build(const std::vector<QString> &terms) override;
+    void freeze() override;
     void clear() override;
-    std::vector<std::shared_ptr<IndexableItem>> search(const QString &req) const override;
+    void save(IndexWriter &writer) const override;
+    bool load(IndexReader &reader) override;
+    void match(const QString &word, std::vector<uint32_t> &terms) const override;
+    const QString &term(uint32_t position) const override { return words_[position]; }
+    bool extends(const QString &word, const QString &extension) const override;
+    std::function<double(const QString &term)> matchQuality(const QString &word) const override;
+
     inline double delta() const {return delta_;}
     inline void setDelta(double d){delta_=d;}
 
 private:
 
-    // Map of qGrams, containing their word references and #occurences
-    std::map<QString,std::map<QString,uint>> qGramIndex_;
+    struct QGramPosting {
+        uint32_t word;
+        uint32_t position;
+    };
+
+    void qGrams(const QString &word, std::vector<uint64_t> &keys) const;
+
+    // The words of the index, referenced by their position
+    std::vector<QString> words_;
+    std::vector<uint32_t> wordLengths_;
+    QHash<QString,uint32_t> wordIds_;
+
+    // The packed qGrams of the words added up to the last build(), sorted.
+    // The postings of the qGram i are [qGramOffsets_[i], qGramOffsets_[i+1]),
+    // sorted by position to look up position windows.
+    MappedArray<uint64_t> qGramKeys_;
+    MappedArray<uint32_t> qGramOffsets_;
+    MappedArray<QGramPosting> qGramPostings_;
+
+    // Map of packed qGrams of the words added since, containing their word
+    // references and positions
+    std::unordered_map<uint64_t,std::vector<QGramPosting>> qGramIndex_;
 
     // Size of the slices
     uint q_;
@@ -0,0 +1,140 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#include <QFile>
+#include <cstring>
+#include "indexfile.h"
+
+namespace {
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t size;
+    uint64_t checksum;
+};
+
+const char MAGIC[8] = {'A','L','B','I','N','D','E','X'};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325;
+const uint64_t FNV_PRIME = 0x100000001b3;
+
+inline uint64_t fnv1a(uint64_t hash, const uchar *data, uint64_t bytes) {
+    for (uint64_t i = 0; i < bytes; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * FNV_PRIME;
+    }
+    return hash;
+}
+
+}
+
+
+/** ***************************************************************************/
+Core::IndexWriter::IndexWriter(const QString &path)
+    : file_(path), size_(0), checksum_(FNV_OFFSET_BASIS) {
+    // Reserve the header, written on commit
+    if (file_.open(QIODevice::WriteOnly)) {
+        Header header = {};
+        file_.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    }
+}
+
+
+/** ***************************************************************************/
+void Core::IndexWriter::write(const void *data, size_t bytes) {
+
+    const uchar *begin = static_cast<const uchar*>(data);
+    uint64_t count = bytes;
+    uint64_t whole = count / 8 * 8;
+
+    file_.write(reinterpret_cast<const char*>(&count), 8);
+    file_.write(reinterpret_cast<const char*>(begin), static_cast<qint64>(count));
+    checksum_ = fnv1a(checksum_, reinterpret_cast<const uchar*>(&count), 8);
+    checksum_ = fnv1a(checksum_, begin, whole);
+
+    // Pad the last word with zeros
+    if (whole < count) {
+        uchar tail[8] = {};
+        memcpy(tail, begin + whole, count - whole);
+        file_.write(reinterpret_cast<const char*>(tail) + (count - whole), static_cast<qint64>(8 - (count - whole)));
+        checksum_ = fnv1a(checksum_, tail, 8);
+    }
+
+    size_ += 8 + (count + 7) / 8 * 8;
+}
+
+
+/** ***************************************************************************/
+bool Core::IndexWriter::commit(uint32_t flags) {
+
+    Header header = {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = INDEX_FILE_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.flags = flags;
+    header.size = size_;
+    header.checksum = checksum_;
+
+    if (!file_.seek(0)
+            || file_.write(reinterpret_cast<const char*>(&header), sizeof(Header)) != sizeof(Header))
+        file_.cancelWriting();
+    return file_.commit();
+}
+
+
+/** ***************************************************************************/
+Core::IndexReader::IndexReader(const QString &path)
+    : file_(std::make_shared<QFile>(path)),
+      payload_(nullptr), size_(0), position_(0), checksum_(0), flags_(0), valid_(false) {
+
+    if (!file_->open(QIODevice::ReadOnly) || file_->size() < static_cast<qint64>(sizeof(Header)))
+        return;
+
+    const uchar *data = file_->map(0, file_->size());
+    if (!data)
+        return;
+
+    Header header;
+    memcpy(&header, data, sizeof(Header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+            || header.version != INDEX_FILE_VERSION
+            || header.byteOrder != BYTE_ORDER_MARK
+            || header.size != static_cast<uint64_t>(file_->size()) - sizeof(Header)
+            || header.size % 8 != 0)
+        return;
+
+    payload_ = data + sizeof(Header);
+    size_ = header.size;
+    checksum_ = header.checksum;
+    flags_ = header.flags;
+    valid_ = true;
+}
+
+
+/** ***************************************************************************/
+bool Core::IndexReader::verify() const {
+    return valid_ && fnv1a(FNV_OFFSET_BASIS, payload_, size_) == checksum_;
+}
+
+
+/** ***************************************************************************/
+bool Core::IndexReader::next(const void *&data, size_t &bytes) {
+
+    if (!valid_ || size_ - position_ < 8)
+        return false;
+
+    uint64_t count;
+    memcpy(&count, payload_ + position_, 8);
+    uint64_t padded = (count + 7) / 8 * 8;
+    if (padded < count || size_ - position_ - 8 < padded)
+        return false;
+
+    data = payload_ + position_ + 8;
+    bytes = static_cast<size_t>(count);
+    position_ += 8 + padded;
+    return true;
+}
@@ -0,0 +1,121 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#pragma once
+#include <QSaveFile>
+#include <QString>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "mappedarray.h"
+class QFile;
+
+namespace Core {
+
+/*
+ * The index file format. All values are in host byte order, files written on
+ * a host of other byte order are rejected.
+ *
+ *   Header    magic, version, byte order mark, flags, payload size, checksum
+ *   Payload   sections, each a 64 bit byte count followed by the bytes,
+ *             padded to 8 bytes. The checksum is the FNV-1a hash of the
+ *             payload, taken over 64 bit words.
+ *
+ * Since the file is mapped at a page boundary, every section is 8 byte
+ * aligned and can be used in place.
+ */
+static constexpr uint32_t INDEX_FILE_VERSION = 2;
+
+/**
+ * @brief The IndexWriter class
+ * Writes the sections of an index file. The file is replaced atomically on
+ * commit().
+ */
+class IndexWriter
+{
+public:
+
+    explicit IndexWriter(const QString &path);
+
+    /** Appends a section */
+    void write(const void *data, size_t bytes);
+
+    template<class T>
+    void write(const std::vector<T> &elements) {
+        write(elements.data(), elements.size() * sizeof(T));
+    }
+
+    template<class T>
+    void write(const MappedArray<T> &elements) {
+        write(elements.data(), elements.size() * sizeof(T));
+    }
+
+    /** Writes the header and replaces the file, false on errors */
+    bool commit(uint32_t flags);
+
+private:
+
+    QSaveFile file_;
+    uint64_t size_;
+    uint64_t checksum_;
+
+};
+
+
+/**
+ * @brief The IndexReader class
+ * Maps an index file and checks its header. The sections are read in the order
+ * they were written, as views into the mapped file. The checksum is verified
+ * on request only, since that reads the whole file, the readers of the
+ * sections check the offsets they use instead.
+ */
+class IndexReader
+{
+public:
+
+    explicit IndexReader(const QString &path);
+
+    /** False if the file could not be mapped or is not a valid index file */
+    bool isValid() const { return valid_; }
+
+    /** The flags passed to IndexWriter::commit() */
+    uint32_t flags() const { return flags_; }
+
+    /** False if the payload does not match the checksum, reads the whole file */
+    bool verify() const;
+
+    /** Views the next section, false if there is none or its size does not fit */
+    template<class T>
+    bool read(MappedArray<T> &elements) {
+        const void *data;
+        size_t bytes;
+        if (!next(data, bytes) || bytes % sizeof(T) != 0)
+            return false;
+        elements = MappedArray<T>(static_cast<const T*>(data), bytes / sizeof(T), file_);
+        return true;
+    }
+
+    /** Copies the next section */
+    template<class T>
+    bool read(std::vector<T> &elements) {
+        MappedArray<T> view;
+        if (!read(view))
+            return false;
+        elements.assign(view.begin(), view.end());
+        return true;
+    }
+
+private:
+
+    bool next(const void *&data, size_t &bytes);
+
+    std::shared_ptr<QFile> file_;
+    const uchar *payload_;
+    uint64_t size_;
+    uint64_t position_;
+    uint64_t checksum_;
+    uint32_t flags_;
+    bool valid_;
+
+};
+
+}
@@ -0,0 +1,70 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Core {
+
+class IndexableItem;
+
+/**
+ * @brief The ItemSlab class
+ * The indexed items, addressed by dense ids. Removing an item leaves a gap,
+ * the index renumbers the items once it dropped their postings. Searches
+ * work on ids and borrow the items, the shared pointers are copied only when
+ * results are handed out. Whether an item is removed is kept in a bitmap, so
+ * dropping removed ids touches neither the items nor their reference counts.
+ */
+class ItemSlab
+{
+public:
+
+    /** The number of ids handed out, including the ones of removed items */
+    uint size() const { return static_cast<uint>(items_.size()); }
+
+    /** Appends the item and returns its id. A null item takes an id but is removed. */
+    uint add(std::shared_ptr<IndexableItem> item) {
+        uint id = size();
+        if (id % 64 == 0)
+            live_.push_back(0);
+        if (item)
+            live_[id / 64] |= uint64_t(1) << (id % 64);
+        items_.push_back(std::move(item));
+        return id;
+    }
+
+    /** Releases the item with the id */
+    void remove(uint id) {
+        live_[id / 64] &= ~(uint64_t(1) << (id % 64));
+        items_[id].reset();
+    }
+
+    void reserve(size_t count) {
+        items_.reserve(count);
+        live_.reserve((count + 63) / 64);
+    }
+
+    void clear() {
+        items_.clear();
+        live_.clear();
+    }
+
+    /** True if the item with the id is not removed */
+    bool contains(uint id) const { return live_[id / 64] & (uint64_t(1) << (id % 64)); }
+
+    /** The item with the id, null if removed */
+    IndexableItem *get(uint id) const { return items_[id].get(); }
+
+    /** Shares the item with the id, null if removed */
+    const std::shared_ptr<IndexableItem> &share(uint id) const { return items_[id]; }
+
+private:
+
+    std::vector<std::shared_ptr<IndexableItem>> items_;
+    std::vector<uint64_t> live_;
+
+};
+
+}
@@ -0,0 +1,50 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace Core {
+
+/**
+ * @brief The MappedArray class
+ * An immutable array, either owning its elements or viewing memory owned by
+ * someone else, e.g. a memory mapped index file. The owner is kept alive by
+ * all copies, copies are cheap and share the elements.
+ */
+template<class T>
+class MappedArray
+{
+public:
+
+    MappedArray() = default;
+
+    /** Takes the elements of the vector */
+    explicit MappedArray(std::vector<T> &&elements) {
+        auto owned = std::make_shared<const std::vector<T>>(std::move(elements));
+        data_ = owned->data();
+        size_ = owned->size();
+        owner_ = std::move(owned);
+    }
+
+    /** Views the elements, owner keeps them alive */
+    MappedArray(const T *data, size_t size, std::shared_ptr<const void> owner)
+        : owner_(std::move(owner)), data_(data), size_(size) { }
+
+    const T *data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const T &operator[](size_t i) const { return data_[i]; }
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + size_; }
+
+private:
+
+    std::shared_ptr<const void> owner_;
+    const T *data_ = nullptr;
+    size_t size_ = 0;
+
+};
+
+}
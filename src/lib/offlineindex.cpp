@@ -2,29 +2,102 @@
 
 #include "albert/util/offlineindex.h"
 #include "albert/indexable.h"
+#include "indexfile.h"
+#include "searchbase.h"
+#include "searchlayer.h"
 #include "prefixsearch.h"
 #include "fuzzysearch.h"
+#include "substringsearch.h"
+
+namespace {
+
+// The index file flags
+const uint32_t FLAG_FUZZY = 1;
+const uint32_t FLAG_SUBSTRING = 2;
+
+}
+
+
+struct Core::OfflineIndex::Cursor::Private
+{
+    SearchBase::Matches matches;
+};
+
+
+/** ***************************************************************************/
+Core::OfflineIndex::Cursor::Cursor() : d(new Private) {
+
+}
+
+
+/** ***************************************************************************/
+Core::OfflineIndex::Cursor::~Cursor() {
+
+}
+
+
+/** ***************************************************************************/
+Core::OfflineIndex::Matches::Matches() {
+
+}
+
+
+/** ***************************************************************************/
+Core::OfflineIndex::Matches::Matches(Matches &&other) = default;
+
+
+/** ***************************************************************************/
+Core::OfflineIndex::Matches &Core::OfflineIndex::Matches::operator=(Matches &&other) = default;
+
+
+/** ***************************************************************************/
+Core::OfflineIndex::Matches::~Matches() {
+
+}
+
+
+/** ***************************************************************************/
+Core::IndexableItem *Core::OfflineIndex::Matches::item(size_t i) const {
+    return index_->item(matches_[i].first);
+}
+
+
+/** ***************************************************************************/
+std::shared_ptr<Core::IndexableItem> Core::OfflineIndex::Matches::share(size_t i) const {
+    return index_->share(matches_[i].first);
+}
 
 
 /** ***************************************************************************/
 Core::OfflineIndex::OfflineIndex(bool fuzzy)
-    : impl_((fuzzy) ? new FuzzySearch() : new PrefixSearch()){
+    : impl_(new PrefixSearch()){
+    if (fuzzy)
+        impl_->setLayer(std::make_shared<FuzzySearch>());
 }
 
 
 /** ***************************************************************************/
-Core::OfflineIndex::OfflineIndex(OfflineIndex &&other) {
-    impl_ = std::move(other.impl_);
+Core::OfflineIndex::OfflineIndex(OfflineIndex &&other)
+    : impl_(std::atomic_exchange(&other.impl_, std::shared_ptr<SearchBase>(new PrefixSearch()))){
+
 }
 
 
 /** ***************************************************************************/
 Core::OfflineIndex &Core::OfflineIndex::operator=(Core::OfflineIndex &&other) {
-    impl_ = std::move(other.impl_);
+    publish(std::move(other));
     return *this;
 }
 
 
+/** ***************************************************************************/
+void Core::OfflineIndex::publish(Core::OfflineIndex &&other) {
+    // Leave other usable, empty
+    std::shared_ptr<SearchBase> next = std::atomic_exchange(&other.impl_, std::shared_ptr<SearchBase>(new PrefixSearch()));
+    std::atomic_store(&impl_, next);
+}
+
+
 /** ***************************************************************************/
 Core::OfflineIndex::~OfflineIndex() {
 
@@ -33,54 +106,177 @@ Core::OfflineIndex::~OfflineIndex() {
 
 /** ***************************************************************************/
 void Core::OfflineIndex::setFuzzy(bool fuzzy) {
-    if (dynamic_cast<FuzzySearch*>(impl_.get())) {
-        if (fuzzy) return;
-        impl_.reset(new PrefixSearch(*dynamic_cast<FuzzySearch*>(impl_.get())));
-    } else if (dynamic_cast<PrefixSearch*>(impl_.get())) {
-        if (!fuzzy) return;
-        impl_.reset(new FuzzySearch(*dynamic_cast<PrefixSearch*>(impl_.get())));
-    } else {
-        throw; //should not happen
-    }
+    // Build the layer aside, searches keep using the current one
+    if (fuzzy != this->fuzzy())
+        std::atomic_load(&impl_)->setLayer(fuzzy ? std::make_shared<FuzzySearch>() : nullptr);
 }
 
 
 /** ***************************************************************************/
 bool Core::OfflineIndex::fuzzy() {
-    return dynamic_cast<FuzzySearch*>(impl_.get()) != nullptr;
+    std::shared_ptr<SearchLayer> layer = std::atomic_load(&impl_)->layer();
+    return layer && layer->type() == SearchLayer::Type::Fuzzy;
+}
+
+
+/** ***************************************************************************/
+void Core::OfflineIndex::setSubstring(bool substring) {
+    if (substring != this->substring())
+        std::atomic_load(&impl_)->setLayer(substring ? std::make_shared<SubstringSearch>() : nullptr);
+}
+
+
+/** ***************************************************************************/
+bool Core::OfflineIndex::substring() {
+    std::shared_ptr<SearchLayer> layer = std::atomic_load(&impl_)->layer();
+    return layer && layer->type() == SearchLayer::Type::Substring;
 }
 
 
 /** ***************************************************************************/
 void Core::OfflineIndex::setDelta(double d) {
-    FuzzySearch* f = dynamic_cast<FuzzySearch*>(impl_.get());
-    if (f)
-        f->setDelta(d);
+    std::shared_ptr<SearchBase> impl = std::atomic_load(&impl_);
+    std::shared_ptr<SearchLayer> layer = impl->layer();
+    if (layer && layer->type() == SearchLayer::Type::Fuzzy) {
+        static_cast<FuzzySearch*>(layer.get())->setDelta(d);
+        impl->modified();
+    }
 }
 
 
 /** ***************************************************************************/
 double Core::OfflineIndex::delta() {
-    FuzzySearch* f = dynamic_cast<FuzzySearch*>(impl_.get());
-    if (f)
-        return f->delta();
+    std::shared_ptr<SearchLayer> layer = std::atomic_load(&impl_)->layer();
+    if (layer && layer->type() == SearchLayer::Type::Fuzzy)
+        return static_cast<FuzzySearch*>(layer.get())->delta();
     return 0;
 }
 
 
+/** ***************************************************************************/
+void Core::OfflineIndex::setAnalysis(uint analysis) {
+    std::atomic_load(&impl_)->setAnalysis(analysis);
+}
+
+
+/** ***************************************************************************/
+uint Core::OfflineIndex::analysis() {
+    return std::atomic_load(&impl_)->analysis();
+}
+
+
 /** ***************************************************************************/
 void Core::OfflineIndex::add(const std::shared_ptr<Core::IndexableItem> &idxble) {
-    impl_->add(idxble);
+    std::atomic_load(&impl_)->add(idxble);
+}
+
+
+/** ***************************************************************************/
+void Core::OfflineIndex::remove(const std::shared_ptr<Core::IndexableItem> &idxble) {
+    std::atomic_load(&impl_)->remove(idxble);
+}
+
+
+/** ***************************************************************************/
+void Core::OfflineIndex::update(const std::shared_ptr<Core::IndexableItem> &idxble) {
+    std::shared_ptr<SearchBase> impl = std::atomic_load(&impl_);
+    impl->remove(idxble);
+    impl->add(idxble);
+}
+
+
+/** ***************************************************************************/
+void Core::OfflineIndex::build() {
+    std::atomic_load(&impl_)->build();
+}
+
+
+/** ***************************************************************************/
+void Core::OfflineIndex::build(const std::vector<std::shared_ptr<Core::IndexableItem>> &items) {
+    std::atomic_load(&impl_)->build(items);
 }
 
 
 /** ***************************************************************************/
 void Core::OfflineIndex::clear() {
-    impl_->clear();
+    std::atomic_load(&impl_)->clear();
+}
+
+
+/** ***************************************************************************/
+bool Core::OfflineIndex::save(const QString &path) {
+    IndexWriter writer(path);
+    std::shared_ptr<SearchBase> impl = std::atomic_load(&impl_);
+    impl->save(writer);
+    std::shared_ptr<SearchLayer> layer = impl->layer();
+    uint32_t flags = 0;
+    if (layer)
+        flags = layer->type() == SearchLayer::Type::Fuzzy ? FLAG_FUZZY : FLAG_SUBSTRING;
+    return writer.commit(flags);
+}
+
+
+/** ***************************************************************************/
+bool Core::OfflineIndex::load(const QString &path, const std::vector<std::shared_ptr<Core::IndexableItem>> &items) {
+    IndexReader reader(path);
+    if (!reader.isValid() || !reader.verify())
+        return false;
+
+    std::shared_ptr<SearchBase> next(new PrefixSearch());
+    if (reader.flags() & FLAG_FUZZY)
+        next->setLayer(std::make_shared<FuzzySearch>());
+    else if (reader.flags() & FLAG_SUBSTRING)
+        next->setLayer(std::make_shared<SubstringSearch>());
+    if (!next->load(reader, items))
+        return false;
+
+    std::atomic_store(&impl_, next);
+    return true;
 }
 
 
 /** ***************************************************************************/
 std::vector<std::shared_ptr<Core::IndexableItem> > Core::OfflineIndex::search(const QString &req) const {
-    return impl_->search(req);
+    // Pin the current index, it may be replaced meanwhile
+    std::shared_ptr<SearchBase> snapshot = std::atomic_load(&impl_);
+    return snapshot->search(req);
+}
+
+
+/** ***************************************************************************/
+std::vector<std::pair<std::shared_ptr<Core::IndexableItem>, uint> > Core::OfflineIndex::search(const QString &req, size_t k) const {
+    std::shared_ptr<SearchBase> snapshot = std::atomic_load(&impl_);
+    return snapshot->search(req, k);
+}
+
+
+/** ***************************************************************************/
+std::vector<std::shared_ptr<Core::IndexableItem> > Core::OfflineIndex::search(const QString &req, Cursor &cursor) const {
+    std::shared_ptr<SearchBase> snapshot = std::atomic_load(&impl_);
+    return snapshot->search(req, cursor.d->matches);
+}
+
+
+/** ***************************************************************************/
+std::vector<std::pair<std::shared_ptr<Core::IndexableItem>, uint> > Core::OfflineIndex::search(const QString &req, size_t k, Cursor &cursor) const {
+    std::shared_ptr<SearchBase> snapshot = std::atomic_load(&impl_);
+    return snapshot->search(req, k, cursor.d->matches);
+}
+
+
+/** ***************************************************************************/
+Core::OfflineIndex::Matches Core::OfflineIndex::match(const QString &req, size_t k) const {
+    Matches matches;
+    matches.index_ = std::atomic_load(&impl_);
+    matches.matches_ = matches.index_->rank(req, k, nullptr);
+    return matches;
+}
+
+
+/** ***************************************************************************/
+Core::OfflineIndex::Matches Core::OfflineIndex::match(const QString &req, size_t k, Cursor &cursor) const {
+    Matches matches;
+    matches.index_ = std::atomic_load(&impl_);
+    matches.matches_ = matches.index_->rank(req, k, &cursor.d->matches);
+    return matches;
 }
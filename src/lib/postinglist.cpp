@@ -0,0 +1,141 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#include <algorithm>
+#include "postinglist.h"
+using std::vector;
+
+namespace {
+
+inline void writeVarint(uint32_t value, vector<uint8_t> &bytes) {
+    while (value >= 0x80) {
+        bytes.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    bytes.push_back(static_cast<uint8_t>(value));
+}
+
+inline uint32_t readVarint(const uint8_t *&pos) {
+    uint32_t value = *pos & 0x7f;
+    for (uint32_t shift = 7; *pos++ & 0x80; shift += 7)
+        value |= static_cast<uint32_t>(*pos & 0x7f) << shift;
+    return value;
+}
+
+}
+
+
+/** ***************************************************************************/
+uint32_t Core::encodePostings(const uint32_t *begin, const uint32_t *end,
+                              vector<uint8_t> &bytes, vector<PostingSkip> &skips) {
+    uint32_t skipCount = 0;
+    uint32_t last = 0;
+    for (const uint32_t *it = begin; it != end; ++it) {
+        uint32_t index = static_cast<uint32_t>(it - begin);
+        if (index > 0 && index % SKIP_INTERVAL == 0) {
+            skips.push_back({last, static_cast<uint32_t>(bytes.size())});
+            ++skipCount;
+        }
+        writeVarint(*it - last, bytes);
+        last = *it;
+    }
+    return skipCount;
+}
+
+
+/** ***************************************************************************/
+void Core::decodePostings(const uint8_t *bytes, uint32_t count, vector<uint32_t> &out) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        value += readVarint(bytes);
+        out.push_back(value);
+    }
+}
+
+
+/** ***************************************************************************/
+bool Core::checkPostings(const uint8_t *bytes, const uint8_t *end, const uint8_t *arena,
+                         const PostingSkip *skips, uint32_t count, uint32_t bound) {
+    uint64_t value = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (i > 0 && i % SKIP_INTERVAL == 0) {
+            const PostingSkip &skip = skips[i / SKIP_INTERVAL - 1];
+            if (skip.last != value || arena + skip.offset != bytes)
+                return false;
+        }
+        // Bounded varint read, at most five bytes
+        uint64_t delta = 0;
+        for (uint32_t shift = 0;; shift += 7) {
+            if (bytes == end || shift > 28)
+                return false;
+            delta |= static_cast<uint64_t>(*bytes & 0x7f) << shift;
+            if (!(*bytes++ & 0x80))
+                break;
+        }
+        if (i > 0 && delta == 0)
+            return false;
+        value += delta;
+        if (value >= bound)
+            return false;
+    }
+    return true;
+}
+
+
+/** ***************************************************************************/
+Core::PostingIterator::PostingIterator(const uint8_t *bytes, const uint8_t *arena,
+                                       const PostingSkip *skips, uint32_t count)
+    : pos_(bytes),
+      arena_(arena),
+      skips_(skips),
+      skipCount_(count > 0 ? (count - 1) / SKIP_INTERVAL : 0),
+      count_(count),
+      index_(0),
+      value_(0) {
+    if (count_ > 0)
+        value_ = readVarint(pos_);
+}
+
+
+/** ***************************************************************************/
+void Core::PostingIterator::next() {
+    if (++index_ < count_)
+        value_ += readVarint(pos_);
+}
+
+
+/** ***************************************************************************/
+void Core::PostingIterator::advanceTo(uint32_t target) {
+
+    if (atEnd() || value_ >= target)
+        return;
+
+    // Block b > 0 can be skipped to if its skip pointer (skips_[b-1]) holds
+    // an id less than target. Gallop over the skip pointers to find the last
+    // such block, then binary search the last galloping step.
+    uint32_t block = index_ / SKIP_INTERVAL;
+    uint32_t lo = block, step = 1;
+    while (lo + step <= skipCount_ && skips_[lo + step - 1].last < target) {
+        lo += step;
+        step *= 2;
+    }
+    uint32_t hi = std::min(lo + step, skipCount_ + 1);
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (skips_[mid - 1].last < target)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    if (lo > block) {
+        const PostingSkip &skip = skips_[lo - 1];
+        index_ = lo * SKIP_INTERVAL - 1;
+        value_ = skip.last;
+        pos_ = arena_ + skip.offset;
+        next();
+    }
+
+    // Decode the rest of the block
+    while (!atEnd() && value_ < target)
+        next();
+}
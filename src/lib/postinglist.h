@@ -0,0 +1,78 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace Core {
+
+/**
+ * @brief A skip pointer of a compressed posting list
+ * Posting lists are delta/varint encoded in blocks of SKIP_INTERVAL ids. Every
+ * block but the first has a skip pointer holding the last id of the preceding
+ * block and the byte offset of the block.
+ */
+struct PostingSkip {
+    uint32_t last;
+    uint32_t offset;
+};
+
+static constexpr uint32_t SKIP_INTERVAL = 64;
+
+/**
+ * @brief Appends a sorted, unique list of ids to the compressed arenas
+ * @return The number of skip pointers appended
+ */
+uint32_t encodePostings(const uint32_t *begin, const uint32_t *end,
+                        std::vector<uint8_t> &bytes, std::vector<PostingSkip> &skips);
+
+/**
+ * @brief Appends the decoded ids of a compressed posting list to out
+ */
+void decodePostings(const uint8_t *bytes, uint32_t count, std::vector<uint32_t> &out);
+
+/**
+ * @brief Checks a compressed posting list read from an untrusted source
+ * The list must decode within [bytes, end) to strictly increasing ids less
+ * than bound and its skip pointers must match the decoded blocks.
+ */
+bool checkPostings(const uint8_t *bytes, const uint8_t *end, const uint8_t *arena,
+                   const PostingSkip *skips, uint32_t count, uint32_t bound);
+
+/**
+ * @brief The PostingIterator class
+ * A forward cursor over a compressed posting list. Decodes lazily and gallops
+ * over the skip pointers when advanced to a target id.
+ */
+class PostingIterator
+{
+public:
+
+    PostingIterator(const uint8_t *bytes, const uint8_t *arena,
+                    const PostingSkip *skips, uint32_t count);
+
+    /** True if the cursor moved past the last id */
+    bool atEnd() const { return index_ >= count_; }
+
+    /** The id at the cursor */
+    uint32_t value() const { return value_; }
+
+    /** Moves the cursor to the next id */
+    void next();
+
+    /** Moves the cursor to the first id not less than target */
+    void advanceTo(uint32_t target);
+
+private:
+
+    const uint8_t *pos_;
+    const uint8_t *arena_;
+    const PostingSkip *skips_;
+    uint32_t skipCount_;
+    uint32_t count_;
+    uint32_t index_;
+    uint32_t value_;
+
+};
+
+}
@@ -0,0 +1,158 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#pragma once
+#include <QString>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace Core {
+
+/*
+ * Checks if the prefix edit distance of a query word to other words is within
+ * a bound. The prefix edit distance is the minimal edit distance of the query
+ * word to any prefix of the other word.
+ *
+ * Words of up to 64 UTF-16 units use the bit-parallel algorithm of Myers in the
+ * formulation of Hyyrö: The column j of the DP matrix (query word × prefixes of
+ * the other word) is encoded in the bit vectors VP/VN, holding the positive
+ * and negative vertical deltas. Bit i-1 represents row i. A column costs a
+ * handful of word operations, the score tracks the last row. Longer words fall
+ * back to a DP over the diagonal band of width 2δ+1.
+ */
+class PrefixEditDistance
+{
+public:
+
+    explicit PrefixEditDistance(const QString &prefix) : prefix_(prefix) {
+        if (prefix_.size() > 64)
+            return;
+        latin1Masks_.fill(0);
+        for (int i = 0; i < prefix_.size(); ++i) {
+            ushort c = prefix_[i].unicode();
+            if (c < 256)
+                latin1Masks_[c] |= uint64_t(1) << i;
+            else {
+                auto it = std::find_if(otherMasks_.begin(), otherMasks_.end(),
+                                       [c](const std::pair<ushort,uint64_t> &m){ return m.first == c; });
+                if (it == otherMasks_.end())
+                    otherMasks_.emplace_back(c, uint64_t(1) << i);
+                else
+                    it->second |= uint64_t(1) << i;
+            }
+        }
+    }
+
+    /** True if the prefix edit distance to str is at most delta */
+    bool operator()(const QString &str, uint delta) const {
+        return compute(str, delta, delta) <= delta;
+    }
+
+    /** The prefix edit distance to str, delta+1 if it exceeds delta */
+    uint distance(const QString &str, uint delta) const {
+        return compute(str, delta, 0);
+    }
+
+private:
+
+    // Returns min(distance, delta+1), or early any distance not above goal
+    uint compute(const QString &str, uint delta, uint goal) const {
+        if (prefix_.isEmpty())
+            return 0;
+        return (prefix_.size() > 64) ? band(str, delta) : bitParallel(str, delta, goal);
+    }
+
+    uint64_t mask(QChar ch) const {
+        ushort c = ch.unicode();
+        if (c < 256)
+            return latin1Masks_[c];
+        for (const std::pair<ushort,uint64_t> &m : otherMasks_)
+            if (m.first == c)
+                return m.second;
+        return 0;
+    }
+
+    uint bitParallel(const QString &str, uint delta, uint goal) const {
+        const uint m = static_cast<uint>(prefix_.size());
+        const uint n = std::min(m + delta, static_cast<uint>(str.size()));
+        const uint64_t lastRow = uint64_t(1) << (m - 1);
+
+        // Column 0: D[i][0] = i, all vertical deltas are +1
+        uint64_t VP = ~uint64_t(0), VN = 0;
+        uint score = m;
+        uint best = std::min(score, delta + 1);
+        if (best <= goal)
+            return best;
+
+        for (uint j = 1; j <= n; ++j) {
+            uint64_t X = mask(str[static_cast<int>(j)-1]) | VN;
+            uint64_t D0 = (((X & VP) + VP) ^ VP) | X;
+            uint64_t HP = VN | ~(D0 | VP);
+            uint64_t HN = VP & D0;
+
+            if (HP & lastRow)
+                ++score;
+            else if (HN & lastRow)
+                --score;
+
+            best = std::min(best, score);
+            if (best <= goal)
+                return best;
+
+            // The score decreases by at most one per column
+            if (score >= best + (n - j))
+                return best;
+
+            // Row 0 is D[0][j] = j, its horizontal delta is +1
+            HP = (HP << 1) | 1;
+            HN = HN << 1;
+            VP = HN | ~(D0 | HP);
+            VN = HP & D0;
+        }
+        return best;
+    }
+
+    uint band(const QString &str, uint delta) const {
+        const uint m = static_cast<uint>(prefix_.size());
+        const uint n = std::min(m + delta, static_cast<uint>(str.size()));
+        const uint inf = delta + 1;  // Cells out of the band, values are capped
+
+        // Row 0: D[0][j] = j
+        std::vector<uint> row(n + 1);
+        for (uint j = 0; j <= n; ++j)
+            row[j] = std::min(j, inf);
+
+        uint rowMin = 0;
+        for (uint i = 1; i <= m; ++i) {
+            uint lo = (i > delta) ? i - delta : 1;
+            uint hi = std::min(n, i + delta);
+
+            uint diagonal = row[lo-1];
+            row[lo-1] = (lo == 1) ? std::min(i, inf) : inf;
+            rowMin = row[lo-1];
+
+            for (uint j = lo; j <= hi; ++j) {
+                uint value = std::min(std::min(diagonal + (prefix_[static_cast<int>(i)-1] == str[static_cast<int>(j)-1] ? 0 : 1),
+                                               row[j] + 1),
+                                      row[j-1] + 1);
+                diagonal = row[j];
+                row[j] = std::min(value, inf);
+                rowMin = std::min(rowMin, row[j]);
+            }
+
+            // The minimum of a row never decreases from row to row
+            if (rowMin > delta)
+                return inf;
+        }
+        return rowMin;
+    }
+
+    const QString prefix_;
+    std::array<uint64_t,256> latin1Masks_;
+    std::vector<std::pair<ushort,uint64_t>> otherMasks_;
+
+};
+
+}
@@ -1,26 +1,41 @@
 // Copyright (C) 2014-2018 Manuel Schneider
 
-#include <QRegularExpression>
+#include <QtAlgorithms>
 #include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <limits>
+#include "albert/util/offlineindex.h"
 #include "indexable.h"
+#include "indexfile.h"
 #include "prefixsearch.h"
+#include "tokenizer.h"
 using std::map;
+using std::pair;
 using std::set;
 using std::shared_ptr;
 using std::vector;
 
+namespace {
 
+// Unions of query words that reference at least every n-th item are built as
+// bitmap instead of a sorted list
+const size_t DENSE_UNION_SPARSITY = 16;
 
-/** ***************************************************************************/
-Core::PrefixSearch::PrefixSearch(){
+// The dictionary is compacted in the background when at least every n-th item
+// is removed, but not for less than COMPACTION_MIN_TOMBSTONES items
+const size_t COMPACTION_SPARSITY = 8;
+const size_t COMPACTION_MIN_TOMBSTONES = 64;
+
+// Marks the ids dropped by renumbering
+const uint DROPPED = std::numeric_limits<uint>::max();
 
 }
 
 
 /** ***************************************************************************/
-Core::PrefixSearch::PrefixSearch(const Core::PrefixSearch &rhs) {
-    index_ = rhs.index_;
-    invertedIndex_ = rhs.invertedIndex_;
+Core::PrefixSearch::PrefixSearch(){
+
 }
 
 
@@ -31,72 +46,1052 @@ Core::PrefixSearch::~PrefixSearch(){}
 /** ***************************************************************************/
 void Core::PrefixSearch::add(const std::shared_ptr<IndexableItem> &indexable) {
 
+    adoptCompaction(false);
+    modified();
+
+    // An item added again replaces the one added before
+    auto it = ids_.find(indexable->id());
+    if (it != ids_.end()) {
+        drop(it.value());
+        compactIfSparse();
+    }
+
     // Add indexable to the index
-    index_.push_back(indexable);
-    uint id = static_cast<uint>(index_.size()-1);
+    uint id = index_.add(indexable);
+    ids_.insert(indexable->id(), id);
+
+    itemTerms_.emplace_back();
+    tokenize(id);
 
-    vector<IndexableItem::IndexString> indexStrings = indexable->indexStrings();
+    // Build an inverted index
+    for (const ItemTerm &t : itemTerms_[id])
+        invertedIndex_[t.term].insert(id);
+
+    if (layer_)
+        for (const ItemTerm &t : itemTerms_[id])
+            layer_->add(t.term);
+}
+
+
+/** ***************************************************************************
+ * @brief Splits the index strings of the item into its terms, keeping the
+ * relevance of each posting. The acronyms of the index strings are terms too,
+ * so they are matched by the same prefix lookup. Touches only the terms of
+ * this item.
+ */
+void Core::PrefixSearch::tokenize(uint id) {
+
+    thread_local vector<QString> words;
+    vector<ItemTerm> &terms = itemTerms_[id];
+    vector<IndexableItem::IndexString> indexStrings = index_.get(id)->indexStrings();
     for (const auto &idxStr : indexStrings) {
-        // Build an inverted index
-        QStringList words = idxStr.string.split(QRegularExpression(SEPARATOR_REGEX), QString::SkipEmptyParts);
-        for (const QString &w : words) {
-            invertedIndex_[w.toLower()].insert(id);
+        words.clear();
+        Core::tokenize(idxStr.string, words, analysis_);
+        if (analysis_ & OfflineIndex::Acronyms)
+            Core::acronyms(idxStr.string, words, analysis_);
+        for (QString &term : words) {
+            auto it = std::find_if(terms.begin(), terms.end(), [&term](const ItemTerm &t){ return t.term == term; });
+            if (it == terms.end())
+                terms.push_back({std::move(term), idxStr.relevance});
+            else
+                it->relevance = std::max(it->relevance, idxStr.relevance);
         }
     }
 }
 
 
+/** ***************************************************************************
+ * @brief Removes the item with the id of the passed item. The item is
+ * tombstoned, its postings are dropped by the next compaction or build().
+ */
+void Core::PrefixSearch::remove(const std::shared_ptr<IndexableItem> &indexable) {
+
+    adoptCompaction(false);
+
+    auto it = ids_.find(indexable->id());
+    if (it == ids_.end())
+        return;
+
+    uint id = it.value();
+    ids_.erase(it);
+    modified();
+    drop(id);
+    compactIfSparse();
+}
+
+
+/** ***************************************************************************
+ * @brief Tombstones the slot of an item, the caller updates ids_
+ */
+void Core::PrefixSearch::drop(uint id) {
+    index_.remove(id);
+    vector<ItemTerm>().swap(itemTerms_[id]);
+    ++tombstones_;
+}
+
+
+/** ***************************************************************************/
+void Core::PrefixSearch::compactIfSparse() {
+    if (tombstones_ - compacting_ >= COMPACTION_MIN_TOMBSTONES
+            && (tombstones_ - compacting_) * COMPACTION_SPARSITY >= index_.size())
+        startCompaction();
+}
+
+
+/** ***************************************************************************/
+void Core::PrefixSearch::build() {
+    adoptCompaction(true);
+    if (invertedIndex_.empty() && tombstones_ == 0)
+        return;
+    mergeDictionary();
+    if (tombstones_ > 0) {
+        modified();
+        renumber(denseIds());
+    }
+    dictionary_ = TermDictionary(invertedIndex_);
+    invertedIndex_.clear();
+    tombstones_ = 0;
+    if (layer_)
+        layer_->freeze();
+}
+
+
+/** ***************************************************************************
+ * @brief Bulk loads the items. The items are tokenized in parallel chunks,
+ * each yielding a sorted run of postings. The runs (and the terms indexed
+ * before) are split at sampled terms into ranges, which are merged in parallel
+ * and laid out back to back as the new dictionary.
+ */
+void Core::PrefixSearch::build(const vector<shared_ptr<IndexableItem>> &items) {
+
+    using Posting = pair<QString,uint>;
+
+    adoptCompaction(true);
+    modified();
+
+    // The terms indexed before form another run, without the removed items
+    mergeDictionary();
+    if (tombstones_ > 0) {
+        renumber(denseIds());
+        tombstones_ = 0;
+    }
+
+    // Items added again replace the ones added before, also within items.
+    // Their postings are dropped by the next compaction or build().
+    uint first = index_.size();
+    index_.reserve(first + items.size());
+    itemTerms_.resize(first + items.size());
+    for (const auto &item : items) {
+        uint id = index_.add(item);
+        auto it = ids_.find(item->id());
+        if (it == ids_.end())
+            ids_.insert(item->id(), id);
+        else {
+            drop(it.value());
+            it.value() = id;
+        }
+    }
+
+    // Tokenize in parallel
+    size_t chunks = parallelChunks(items.size());
+    vector<vector<Posting>> runs(chunks + 1);
+    parallelFor(chunks, [&](size_t c){
+        vector<Posting> &run = runs[c];
+        for (size_t i = items.size() * c / chunks; i < items.size() * (c + 1) / chunks; ++i) {
+            uint id = first + static_cast<uint>(i);
+            if (!index_.contains(id))
+                continue;
+            tokenize(id);
+            for (const ItemTerm &t : itemTerms_[id])
+                run.emplace_back(t.term, id);
+        }
+        std::sort(run.begin(), run.end());
+    });
+
+    for (const auto &entry : invertedIndex_)
+        for (uint id : entry.second)
+            runs.back().emplace_back(entry.first, id);
+    invertedIndex_.clear();
+
+    // Split the term space at evenly spaced samples of the runs
+    vector<QString> samples, bounds;
+    for (const auto &run : runs)
+        for (size_t c = 1; c < chunks && !run.empty(); ++c)
+            samples.push_back(run[run.size() * c / chunks].first);
+    std::sort(samples.begin(), samples.end());
+    for (size_t c = 1; c < chunks && !samples.empty(); ++c)
+        bounds.push_back(samples[samples.size() * c / chunks]);
+    size_t ranges = bounds.size() + 1;
+
+    // Merge the runs range by range
+    auto lessTerm = [](const Posting &p, const QString &term){ return p.first < term; };
+    vector<vector<pair<QString,vector<uint32_t>>>> parts(ranges);
+    parallelFor(ranges, [&](size_t r){
+        vector<Posting> merged;
+        vector<size_t> ends{0};
+        for (const auto &run : runs) {
+            auto begin = (r == 0) ? run.begin() : std::lower_bound(run.begin(), run.end(), bounds[r-1], lessTerm);
+            auto end = (r == ranges - 1) ? run.end() : std::lower_bound(begin, run.end(), bounds[r], lessTerm);
+            merged.insert(merged.end(), begin, end);
+            ends.push_back(merged.size());
+        }
+
+        // Merge the sorted runs pairwise, halving their number each pass
+        while (ends.size() > 2) {
+            vector<size_t> next{0};
+            for (size_t i = 2; i < ends.size(); i += 2) {
+                std::inplace_merge(merged.begin() + static_cast<long>(ends[i-2]),
+                                   merged.begin() + static_cast<long>(ends[i-1]),
+                                   merged.begin() + static_cast<long>(ends[i]));
+                next.push_back(ends[i]);
+            }
+            if (ends.size() % 2 == 0)
+                next.push_back(ends.back());
+            ends = std::move(next);
+        }
+
+        for (const Posting &p : merged) {
+            if (parts[r].empty() || parts[r].back().first != p.first)
+                parts[r].emplace_back(p.first, vector<uint32_t>());
+            vector<uint32_t> &ids = parts[r].back().second;
+            if (ids.empty() || ids.back() != p.second)
+                ids.push_back(p.second);
+        }
+    });
+
+    vector<pair<QString,vector<uint32_t>>> terms;
+    for (auto &part : parts)
+        std::move(part.begin(), part.end(), std::back_inserter(terms));
+    dictionary_ = TermDictionary(terms);
+
+    if (layer_) {
+        vector<QString> layerTerms;
+        layerTerms.reserve(terms.size());
+        for (auto &term : terms)
+            layerTerms.push_back(std::move(term.first));
+        layer_->build(layerTerms);
+    }
+
+    compactIfSparse();
+}
+
+
 /** ***************************************************************************/
 void Core::PrefixSearch::clear() {
+    adoptCompaction(true);
+    modified();
     invertedIndex_.clear();
+    dictionary_ = TermDictionary();
+    itemTerms_.clear();
     index_.clear();
+    ids_.clear();
+    tombstones_ = 0;
+    if (layer_)
+        layer_->clear();
+}
+
+
+/** ***************************************************************************
+ * @brief The terms change, the items are reindexed
+ */
+void Core::PrefixSearch::setAnalysis(uint analysis) {
+
+    if (analysis == analysis_)
+        return;
+    analysis_ = analysis;
+    modified();
+
+    vector<shared_ptr<IndexableItem>> items;
+    for (uint id = 0; id < index_.size(); ++id)
+        if (index_.contains(id))
+            items.push_back(index_.share(id));
+    if (items.empty())
+        return;
+
+    clear();
+    build(items);
+}
+
+
+/** ***************************************************************************
+ * @brief Builds and writes the index. The items are stored by their ids, the
+ * terms of each item as positions in the dictionary.
+ */
+void Core::PrefixSearch::save(IndexWriter &writer) {
+
+    build();
+
+    vector<QChar> idChars;
+    vector<uint32_t> idOffsets{0};
+    vector<uint8_t> live;
+    vector<uint32_t> termOffsets{0};
+    vector<ItemTermEntry> terms;
+    for (uint id = 0; id < index_.size(); ++id) {
+        live.push_back(index_.contains(id) ? 1 : 0);
+        if (index_.contains(id)) {
+            QString itemId = index_.get(id)->id();
+            idChars.insert(idChars.end(), itemId.cbegin(), itemId.cend());
+            for (const ItemTerm &t : itemTerms_[id])
+                terms.push_back({dictionary_.find(t.term), t.relevance});
+        }
+        idOffsets.push_back(static_cast<uint32_t>(idChars.size()));
+        termOffsets.push_back(static_cast<uint32_t>(terms.size()));
+    }
+
+    writer.write(&analysis_, sizeof(analysis_));
+    writer.write(idChars);
+    writer.write(idOffsets);
+    writer.write(live);
+    writer.write(termOffsets);
+    writer.write(terms);
+    dictionary_.save(writer);
+    if (layer_)
+        layer_->save(writer);
+}
+
+
+/** ***************************************************************************
+ * @brief Reads the index, the dictionary is used in place. Fails if any of the
+ * indexed items is not among the items.
+ */
+bool Core::PrefixSearch::load(IndexReader &reader, const vector<shared_ptr<IndexableItem>> &items) {
+
+    vector<uint> analysis;
+    MappedArray<QChar> idChars;
+    MappedArray<uint32_t> idOffsets;
+    MappedArray<uint8_t> live;
+    MappedArray<uint32_t> termOffsets;
+    MappedArray<ItemTermEntry> terms;
+    TermDictionary dictionary;
+    if (!reader.read(analysis) || !reader.read(idChars) || !reader.read(idOffsets) || !reader.read(live)
+            || !reader.read(termOffsets) || !reader.read(terms) || analysis.size() != 1)
+        return false;
+
+    size_t count = live.size();
+    if (idOffsets.size() != count + 1 || termOffsets.size() != count + 1
+            || idOffsets[count] != idChars.size() || termOffsets[count] != terms.size()
+            || !dictionary.load(reader, static_cast<uint>(count)))
+        return false;
+
+    QHash<QString,shared_ptr<IndexableItem>> itemsById;
+    for (const auto &item : items)
+        itemsById.insert(item->id(), item);
+
+    // The terms are shared by the items containing them
+    vector<QString> dictionaryTerms(dictionary.size());
+
+    ItemSlab index;
+    index.reserve(count);
+    vector<vector<ItemTerm>> itemTerms(count);
+    QHash<QString,uint> ids;
+    for (uint id = 0; id < count; ++id) {
+        if (!live[id]) {
+            index.add(nullptr);
+            continue;
+        }
+
+        if (idOffsets[id] > idOffsets[id+1] || idOffsets[id+1] > idChars.size()
+                || termOffsets[id] > termOffsets[id+1] || termOffsets[id+1] > terms.size())
+            return false;
+        QString itemId(idChars.data() + idOffsets[id], static_cast<int>(idOffsets[id+1] - idOffsets[id]));
+        auto it = itemsById.find(itemId);
+        if (it == itemsById.end())
+            return false;
+        index.add(it.value());
+        ids.insert(itemId, id);
+
+        for (uint32_t t = termOffsets[id]; t < termOffsets[id+1]; ++t) {
+            uint32_t term = terms[t].term;
+            if (term >= dictionaryTerms.size())
+                return false;
+            if (dictionaryTerms[term].isNull())
+                dictionaryTerms[term] = dictionary.term(term);
+            itemTerms[id].push_back({dictionaryTerms[term], terms[t].relevance});
+        }
+    }
+
+    clear();
+    analysis_ = analysis.front();
+    index_ = std::move(index);
+    itemTerms_ = std::move(itemTerms);
+    dictionary_ = std::move(dictionary);
+    ids_ = std::move(ids);
+    if (layer_ && !layer_->load(reader)) {
+        clear();
+        return false;
+    }
+    return true;
 }
 
 
 /** ***************************************************************************/
 vector<shared_ptr<Core::IndexableItem> > Core::PrefixSearch::search(const QString &query) const {
+    thread_local vector<uint> ids;
+    shared_ptr<const SearchLayer> layer = std::atomic_load(&layer_);
+    match(splitString(query), ids, layer.get());
+    return items(ids);
+}
+
 
-    // Make words unique, lower and prefixfree
+/** ***************************************************************************/
+vector<pair<shared_ptr<Core::IndexableItem>, uint> > Core::PrefixSearch::search(const QString &query, size_t k) const {
+    return items(rank(query, k, nullptr));
+}
+
+
+/** ***************************************************************************/
+vector<shared_ptr<Core::IndexableItem> > Core::PrefixSearch::search(const QString &query, Matches &previous) const {
+    uint64_t generation = generation_;
+    shared_ptr<const SearchLayer> layer = std::atomic_load(&layer_);
+    refine(splitString(query), previous, layer.get(), generation);
+    return items(previous.ids);
+}
+
+
+/** ***************************************************************************/
+vector<pair<shared_ptr<Core::IndexableItem>, uint> > Core::PrefixSearch::search(const QString &query, size_t k, Matches &previous) const {
+    return items(rank(query, k, &previous));
+}
+
+
+/** ***************************************************************************
+ * @brief The generation is read before the layer. setLayer() stores the layer
+ * before the generation, so matches never carry the generation of a newer
+ * layer than the one they were matched by.
+ */
+vector<pair<uint, uint> > Core::PrefixSearch::rank(const QString &query, size_t k, Matches *previous) const {
+    uint64_t generation = generation_;
+    shared_ptr<const SearchLayer> layer = std::atomic_load(&layer_);
+    if (previous) {
+        refine(splitString(query), *previous, layer.get(), generation);
+        return topMatches(previous->words, previous->ids, k, layer.get());
+    }
+    thread_local vector<uint> ids;
     set<QString> words = splitString(query);
+    match(words, ids, layer.get());
+    return topMatches(words, ids, k, layer.get());
+}
+
+
+/** ***************************************************************************/
+Core::IndexableItem *Core::PrefixSearch::item(uint id) const {
+    return index_.get(id);
+}
+
+
+/** ***************************************************************************/
+shared_ptr<Core::IndexableItem> Core::PrefixSearch::share(uint id) const {
+    return index_.share(id);
+}
+
+
+/** ***************************************************************************
+ * @brief The layer is built from the terms of the dictionary and the inverted
+ * index, which are only read meanwhile. The previous layer is freed when the
+ * last search using it finished.
+ */
+void Core::PrefixSearch::setLayer(shared_ptr<SearchLayer> layer) {
+
+    if (layer) {
+        vector<QString> terms;
+        terms.reserve(dictionary_.size() + invertedIndex_.size());
+        for (uint i = 0; i < dictionary_.size(); ++i)
+            terms.push_back(dictionary_.term(i));
+        for (const auto &entry : invertedIndex_)
+            terms.push_back(entry.first);
+        layer->build(terms);
+    }
+
+    std::atomic_store(&layer_, layer);
+    modified();
+}
+
+
+/** ***************************************************************************/
+shared_ptr<Core::SearchLayer> Core::PrefixSearch::layer() const {
+    return std::atomic_load(&layer_);
+}
+
+
+/** ***************************************************************************/
+vector<shared_ptr<Core::IndexableItem> > Core::PrefixSearch::items(const vector<uint> &ids) const {
+
+    // Convert to a std::vector
+    vector<shared_ptr<IndexableItem>> resultsVector;
+    resultsVector.reserve(ids.size());
+    for (uint id : ids)
+        resultsVector.emplace_back(index_.share(id));
+    return resultsVector;
+}
+
+
+/** ***************************************************************************/
+vector<pair<shared_ptr<Core::IndexableItem>, uint> > Core::PrefixSearch::items(const vector<pair<uint, uint>> &matches) const {
+    vector<pair<shared_ptr<IndexableItem>,uint>> results;
+    results.reserve(matches.size());
+    for (const pair<uint,uint> &match : matches)
+        results.emplace_back(index_.share(match.first), match.second);
+    return results;
+}
+
+
+/** ***************************************************************************
+ * @brief Scores the matches and keeps the k best in a bounded min-heap, so
+ * that only these are materialized. Works on ids, the items are not touched. Every query word scores the best posting
+ * of the item it matches, its relevance weighted by the match quality. The
+ * score of the item is the mean over the words.
+ * @return The ids and scores of the k best matches, best first
+ */
+vector<pair<uint, uint> > Core::PrefixSearch::topMatches(const set<QString> &words, const vector<uint> &ids,
+                                                         size_t k, const SearchLayer *layer) const {
+
+    thread_local vector<pair<uint,uint>> heap; // score, id
+
+    vector<std::function<double(const QString &)>> qualities;
+    for (const QString &word : words)
+        qualities.push_back(matchQuality(word, layer));
+
+    // The heap keeps the worst of the best k on top. Ties are won by the item
+    // added first.
+    auto better = [](const pair<uint,uint> &l, const pair<uint,uint> &r){
+        return l.first > r.first || (l.first == r.first && l.second < r.second);
+    };
+
+    heap.clear();
+    for (uint id : ids) {
+        double sum = 0;
+        for (const auto &quality : qualities) {
+            double best = 0;
+            for (const ItemTerm &t : itemTerms_[id])
+                if (t.relevance > best)
+                    best = std::max(best, t.relevance * quality(t.term));
+            sum += best;
+        }
+        uint score = static_cast<uint>(sum / qualities.size());
+
+        if (heap.size() < k) {
+            heap.emplace_back(score, id);
+            std::push_heap(heap.begin(), heap.end(), better);
+        } else if (k > 0 && better({score, id}, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = {score, id};
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+    }
+    std::sort_heap(heap.begin(), heap.end(), better);
+
+    vector<pair<uint,uint>> results;
+    results.reserve(heap.size());
+    for (const pair<uint,uint> &entry : heap)
+        results.emplace_back(entry.second, entry.first);
+    return results;
+}
+
+
+/** ***************************************************************************
+ * @brief If every previous word is extended by a word of the query, the query
+ * matches a subset of the previous matches. These are refined then, instead of
+ * searching the index from scratch. Only the words that are not previous words
+ * have to be checked.
+ */
+void Core::PrefixSearch::refine(set<QString> words, Matches &previous,
+                                const SearchLayer *layer, uint64_t generation) const {
+
+    bool refinable = previous.generation == generation && !previous.words.empty();
+    for (auto w = previous.words.cbegin(); refinable && w != previous.words.cend(); ++w)
+        refinable = std::any_of(words.cbegin(), words.cend(),
+                                [this, &w, layer](const QString &word){ return extends(*w, word, layer); });
+
+    if (refinable) {
+        set<QString> added;
+        std::set_difference(words.cbegin(), words.cend(), previous.words.cbegin(), previous.words.cend(),
+                            std::inserter(added, added.end()));
+        refineMatches(added, previous.ids, layer);
+    } else {
+        match(words, previous.ids, layer);
+        previous.generation = generation;
+    }
+
+    previous.words = std::move(words);
+}
+
+
+/** ***************************************************************************/
+void Core::PrefixSearch::match(const set<QString> &words, vector<uint> &results, const SearchLayer *layer) const {
+
+    results.clear();
 
     // Skip if there arent any // CONSTRAINT (2): |W| > 0
     if (words.empty())
-        return vector<shared_ptr<IndexableItem>>();
+        return;
+
+    if (layer) {
+        matchLayer(words, results, *layer);
+        return;
+    }
+
+    // If any U_w is empty, so is the intersection
+    vector<WordMatches> matches;
+    if (!lookUp(words, matches))
+        return;
 
-    set<uint> resultsSet;
-    set<QString>::iterator wordIt = words.begin();
+    // Unions of frequent words (short prefixes) are built as bitmaps. Since
+    // the words are sorted by frequency, all words are frequent then and the
+    // intersections are word level ANDs.
+    if (matches.front().estimate * DENSE_UNION_SPARSITY >= index_.size()) {
 
-    // Get a word mapping once before going to handle intersections
-    for (std::map<QString,std::set<uint>>::const_iterator lb = invertedIndex_.lower_bound(*wordIt);
-         lb != invertedIndex_.cend() && lb->first.startsWith(*wordIt); ++lb)
-        resultsSet.insert(lb->second.begin(), lb->second.end());
-    wordIt++;
+        thread_local vector<uint64_t> bits, bitsBuffer;
+        unitePostings(matches.front(), bits);
 
-    for (;wordIt != words.end(); ++wordIt) {
+        for (auto m = std::next(matches.begin()); m != matches.end(); ++m) {
+            unitePostings(*m, bitsBuffer);
+            uint64_t any = 0;
+            for (size_t w = 0; w < bits.size(); ++w)
+                any |= bits[w] &= bitsBuffer[w];
 
-        // Unite the sets that are mapped by words that begin with word
-        // w ∈ W. This set is called U_w
-        set<uint> wordMappingsUnion;
-        for (std::map<QString,std::set<uint>>::const_iterator lb = invertedIndex_.lower_bound(*wordIt);
-             lb != invertedIndex_.cend() && lb->first.startsWith(*wordIt); ++lb)
-            wordMappingsUnion.insert(lb->second.begin(), lb->second.end());
+            // Break if intersection is empty
+            if (!any)
+                return;
+        }
+
+        for (size_t w = 0; w < bits.size(); ++w)
+            for (uint64_t word = bits[w]; word; word &= word - 1)
+                results.push_back(static_cast<uint>(w * 64 + qCountTrailingZeroBits(word)));
+
+    } else {
+
+        unitePostings(matches.front(), results);
+
+        for (auto m = std::next(matches.begin()); m != matches.end(); ++m) {
+            intersectPostings(*m, results);
+
+            // Break if intersection is empty
+            if (results.empty())
+                return;
+        }
+    }
+
+    // Postings of removed items are dropped lazily
+    dropRemoved(results);
+}
+
+
+/** ***************************************************************************
+ * @brief Unites the postings of the terms the layer matches for each word and
+ * intersects these unions.
+ */
+void Core::PrefixSearch::matchLayer(const set<QString> &words, vector<uint> &ids, const SearchLayer &layer) const {
+
+    thread_local vector<uint32_t> terms;
+    thread_local vector<uint> items;
+
+    bool first = true;
+    for (const QString &word : words) {
 
-        // Intersect all sets U_w with the results
-        set<uint> intersection;
-        std::set_intersection(resultsSet.begin(), resultsSet.end(),
-                              wordMappingsUnion.begin(), wordMappingsUnion.end(),
-                              std::inserter(intersection, intersection.begin()));
+        // Unite the items referenced by the terms
+        layer.match(word, terms);
+        items.clear();
+        for (uint32_t t : terms)
+            termPostings(layer.term(t), items);
+        std::sort(items.begin(), items.end());
+        items.erase(std::unique(items.begin(), items.end()), items.end());
+
+        // Intersect with the items of the preceding words
+        if (first) {
+            ids.swap(items);
+            first = false;
+        } else {
+            size_t kept = 0;
+            auto it = items.cbegin();
+            for (uint id : ids) {
+                it = std::lower_bound(it, items.cend(), id);
+                if (it == items.cend())
+                    break;
+                if (*it == id)
+                    ids[kept++] = id;
+            }
+            ids.resize(kept);
+        }
 
         // Break if intersection is empty
-        if (intersection.empty())
-            return vector<shared_ptr<IndexableItem>>();
+        if (ids.empty())
+            return;
+    }
 
-        resultsSet = std::move(intersection);
+    // Postings of removed items are dropped lazily
+    dropRemoved(ids);
+}
+
+
+/** ***************************************************************************
+ * @brief Intersects the previous matches with the postings of the words, like
+ * match() intersects the postings of the rarer words. Checking the terms of
+ * the previous matches is cheaper than matching the words of a layer against
+ * all terms.
+ */
+void Core::PrefixSearch::refineMatches(const set<QString> &words, vector<uint> &ids, const SearchLayer *layer) const {
+
+    if (layer) {
+        filterByTerms(words, ids, layer);
+        return;
     }
 
-    // Convert to a std::vector
-    vector<shared_ptr<IndexableItem>> resultsVector;
-    for (uint id : resultsSet)
-        resultsVector.emplace_back(index_.at(id));
-    return resultsVector;
+    vector<WordMatches> matches;
+    if (!lookUp(words, matches)) {
+        ids.clear();
+        return;
+    }
+
+    for (const WordMatches &m : matches) {
+        intersectPostings(m, ids);
+        if (ids.empty())
+            return;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Keeps the matches having a term of non-zero quality for every word
+ */
+void Core::PrefixSearch::filterByTerms(const set<QString> &words, vector<uint> &ids, const SearchLayer *layer) const {
+
+    vector<std::function<double(const QString &)>> qualities;
+    for (const QString &word : words)
+        qualities.push_back(matchQuality(word, layer));
+
+    size_t kept = 0;
+    for (uint id : ids) {
+        bool matches = true;
+        for (auto quality = qualities.cbegin(); matches && quality != qualities.cend(); ++quality)
+            matches = std::any_of(itemTerms_[id].cbegin(), itemTerms_[id].cend(),
+                                  [&quality](const ItemTerm &t){ return (*quality)(t.term) > 0; });
+        if (matches)
+            ids[kept++] = id;
+    }
+    ids.resize(kept);
+}
+
+
+/** ***************************************************************************
+ * @brief Looks up the terms starting with each word w ∈ W. Their posting lists
+ * unite to the set U_w.
+ * @return The matches of the words, rarest first. False if any U_w is empty.
+ */
+bool Core::PrefixSearch::lookUp(const set<QString> &words, vector<WordMatches> &matches) const {
+
+    matches.clear();
+    matches.reserve(words.size());
+    for (const QString &word : words) {
+        WordMatches m;
+        m.postings = dictionary_.prefixPostings(word);
+        m.stagedBegin = invertedIndex_.lower_bound(word);
+        m.stagedEnd = m.stagedBegin;
+        m.lists = m.postings.second - m.postings.first;
+        m.estimate = 0;
+        for (uint i = m.postings.first; i < m.postings.second; ++i)
+            m.estimate += dictionary_.postingCount(i);
+        for (; m.stagedEnd != invertedIndex_.cend() && m.stagedEnd->first.startsWith(word); ++m.stagedEnd) {
+            m.estimate += m.stagedEnd->second.size();
+            ++m.lists;
+        }
+        if (m.estimate == 0)
+            return false;
+        matches.push_back(m);
+    }
+
+    // Start with the rarest word, the results can only shrink from there
+    std::sort(matches.begin(), matches.end(), [](const WordMatches &l, const WordMatches &r){
+        return l.estimate < r.estimate;
+    });
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Removes the ids from the sorted results that are not in U_w
+ */
+void Core::PrefixSearch::intersectPostings(const WordMatches &matches, vector<uint> &results) const {
+
+    // Scratch buffers, reused by the queries running in this thread
+    thread_local vector<uint> buffer;
+    thread_local vector<uint64_t> bitsBuffer;
+
+    // Few results are cheaper to probe in the posting lists (galloping
+    // over the skip pointers) than decoding the whole union U_w
+    if (results.size() * matches.lists < matches.estimate)
+        filterPostings(matches, results);
+    else if (matches.estimate * DENSE_UNION_SPARSITY >= index_.size()) {
+        unitePostings(matches, bitsBuffer);
+        results.erase(std::remove_if(results.begin(), results.end(), [](uint id){
+                          return !(bitsBuffer[id / 64] & (uint64_t(1) << (id % 64)));
+                      }),
+                      results.end());
+    } else {
+        unitePostings(matches, buffer);
+        size_t kept = 0;
+        auto b = buffer.cbegin();
+        for (uint id : results) {
+            b = std::lower_bound(b, buffer.cend(), id);
+            if (b == buffer.cend())
+                break;
+            if (*b == id)
+                results[kept++] = id;
+        }
+        results.resize(kept);
+    }
+}
+
+
+/** ***************************************************************************/
+bool Core::PrefixSearch::extends(const QString &word, const QString &extension, const SearchLayer *layer) const {
+    return layer ? layer->extends(word, extension) : extension.startsWith(word);
+}
+
+
+/** ***************************************************************************
+ * @brief A term starting with the word matches by the share of the term the
+ * word covers, 1 for the exact word.
+ */
+std::function<double(const QString &)> Core::PrefixSearch::matchQuality(const QString &word, const SearchLayer *layer) const {
+    if (layer)
+        return layer->matchQuality(word);
+    return [word](const QString &term){
+        return term.startsWith(word) ? static_cast<double>(word.size()) / term.size() : 0.0;
+    };
+}
+
+
+/** ***************************************************************************/
+void Core::PrefixSearch::mergeDictionary() {
+    vector<uint> ids;
+    for (uint i = 0; i < dictionary_.size(); ++i) {
+        ids.clear();
+        dictionary_.appendPostings(i, ids);
+        invertedIndex_[dictionary_.term(i)].insert(ids.begin(), ids.end());
+    }
+    dictionary_ = TermDictionary();
+}
+
+
+/** ***************************************************************************/
+void Core::PrefixSearch::termPostings(const QString &term, vector<uint> &ids) const {
+
+    size_t begin = ids.size();
+
+    uint i = dictionary_.find(term);
+    if (i < dictionary_.size())
+        dictionary_.appendPostings(i, ids);
+
+    auto it = invertedIndex_.find(term);
+    if (it != invertedIndex_.end()) {
+        bool merge = ids.size() > begin;
+        ids.insert(ids.end(), it->second.begin(), it->second.end());
+        if (merge) {
+            std::sort(ids.begin() + static_cast<long>(begin), ids.end());
+            ids.erase(std::unique(ids.begin() + static_cast<long>(begin), ids.end()), ids.end());
+        }
+    }
+}
+
+
+/** ***************************************************************************/
+void Core::PrefixSearch::dropRemoved(vector<uint> &ids) const {
+    if (tombstones_ > 0)
+        ids.erase(std::remove_if(ids.begin(), ids.end(), [this](uint id){ return !index_.contains(id); }),
+                  ids.end());
+}
+
+
+
+/** ***************************************************************************
+ * @brief Maps the ids of the items to dense ids in the same order, the ones of
+ * removed items to DROPPED.
+ */
+vector<uint> Core::PrefixSearch::denseIds() const {
+    vector<uint> remap(index_.size());
+    uint next = 0;
+    for (uint id = 0; id < index_.size(); ++id)
+        remap[id] = index_.contains(id) ? next++ : DROPPED;
+    return remap;
+}
+
+
+/** ***************************************************************************
+ * @brief Renumbers the items and the postings of the inverted index by the
+ * remap, which preserves the order of the ids. Items with DROPPED ids are
+ * dropped, removed items with an id are kept as such. The dictionary is left
+ * to the caller.
+ */
+void Core::PrefixSearch::renumber(const vector<uint> &remap) {
+
+    ItemSlab index;
+    vector<vector<ItemTerm>> itemTerms;
+    index.reserve(index_.size());
+    itemTerms.reserve(index_.size());
+    for (uint id = 0; id < index_.size(); ++id)
+        if (remap[id] != DROPPED) {
+            index.add(index_.share(id));
+            itemTerms.push_back(std::move(itemTerms_[id]));
+        }
+    index_ = std::move(index);
+    itemTerms_ = std::move(itemTerms);
+
+    for (auto it = ids_.begin(); it != ids_.end(); ++it)
+        it.value() = remap[it.value()];
+
+    map<QString,set<uint>> invertedIndex;
+    for (const auto &entry : invertedIndex_) {
+        set<uint> ids;
+        for (uint id : entry.second)
+            if (remap[id] != DROPPED)
+                ids.emplace_hint(ids.end(), remap[id]);
+        if (!ids.empty())
+            invertedIndex.emplace_hint(invertedIndex.end(), entry.first, std::move(ids));
+    }
+    invertedIndex_.swap(invertedIndex);
+}
+
+
+/** ***************************************************************************
+ * @brief Rebuilds the dictionary without the postings of the items removed so
+ * far in a background thread, renumbering the remaining items densely.
+ * Modifications do not touch the dictionary until the compaction is adopted,
+ * so it can be read concurrently.
+ */
+void Core::PrefixSearch::startCompaction() {
+
+    if (compaction_.valid() || dictionary_.empty())
+        return;
+
+    compactionIds_ = denseIds();
+    compacting_ = tombstones_;
+
+    compaction_ = std::async(std::launch::async, [this, remap = compactionIds_](){
+        map<QString,set<uint>> invertedIndex;
+        vector<uint> ids;
+        for (uint i = 0; i < dictionary_.size(); ++i) {
+            ids.clear();
+            dictionary_.appendPostings(i, ids);
+            set<uint> remapped;
+            for (uint id : ids)
+                if (remap[id] != DROPPED)
+                    remapped.emplace_hint(remapped.end(), remap[id]);
+            if (!remapped.empty())
+                invertedIndex.emplace_hint(invertedIndex.end(), dictionary_.term(i), std::move(remapped));
+        }
+        return TermDictionary(invertedIndex);
+    });
+}
+
+
+/** ***************************************************************************
+ * @brief Replaces the dictionary by the compacted one, if there is one, and
+ * renumbers the items in the same step. The items added meanwhile follow the
+ * compacted ones, the ones removed meanwhile keep their ids and postings
+ * until the next compaction.
+ */
+void Core::PrefixSearch::adoptCompaction(bool wait) {
+
+    if (!compaction_.valid())
+        return;
+
+    if (!wait && compaction_.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
+
+    vector<uint> remap = std::move(compactionIds_);
+    uint next = static_cast<uint>(remap.size() - std::count(remap.begin(), remap.end(), DROPPED));
+    while (remap.size() < index_.size())
+        remap.push_back(next++);
+
+    modified();
+    dictionary_ = compaction_.get();
+    renumber(remap);
+    tombstones_ -= compacting_;
+    compacting_ = 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Decodes the sorted, unique ids of the items referenced by the matched
+ * terms, from both the dictionary and the inverted index.
+ */
+void Core::PrefixSearch::unitePostings(const WordMatches &matches, vector<uint> &result) const {
+
+    result.clear();
+    result.reserve(matches.estimate);
+
+    for (uint i = matches.postings.first; i < matches.postings.second; ++i)
+        dictionary_.appendPostings(i, result);
+
+    for (auto it = matches.stagedBegin; it != matches.stagedEnd; ++it)
+        result.insert(result.end(), it->second.begin(), it->second.end());
+
+    // A single list is sorted and unique already
+    if (matches.lists > 1) {
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Sets the bits of the ids of the items referenced by the matched terms
+ * in a bitmap spanning all items.
+ */
+void Core::PrefixSearch::unitePostings(const WordMatches &matches, vector<uint64_t> &bits) const {
+
+    bits.assign((index_.size() + 63) / 64, 0);
+
+    for (uint i = matches.postings.first; i < matches.postings.second; ++i)
+        dictionary_.unitePostings(i, bits.data());
+
+    for (auto it = matches.stagedBegin; it != matches.stagedEnd; ++it)
+        for (uint id : it->second)
+            bits[id / 64] |= uint64_t(1) << (id % 64);
+}
+
+
+/** ***************************************************************************
+ * @brief Removes the ids from the sorted results that are not referenced by any
+ * of the matched terms. The posting lists are decoded lazily, the cursors only
+ * move forward, since the results are sorted.
+ */
+void Core::PrefixSearch::filterPostings(const WordMatches &matches, vector<uint> &results) const {
+
+    thread_local vector<PostingIterator> cursors;
+    thread_local vector<uint> bitmaps;
+    cursors.clear();
+    bitmaps.clear();
+    for (uint i = matches.postings.first; i < matches.postings.second; ++i)
+        if (dictionary_.isBitmap(i))
+            bitmaps.push_back(i);
+        else
+            cursors.push_back(dictionary_.postings(i));
+
+    size_t kept = 0;
+    for (uint id : results) {
+        bool found = false;
+
+        for (size_t c = 0; c < cursors.size() && !found;) {
+            cursors[c].advanceTo(id);
+            if (cursors[c].atEnd()) {
+                // Exhausted, drop it
+                cursors[c] = cursors.back();
+                cursors.pop_back();
+                continue;
+            }
+            found = cursors[c].value() == id;
+            ++c;
+        }
+
+        for (size_t b = 0; b < bitmaps.size() && !found; ++b)
+            found = dictionary_.bitmapContains(bitmaps[b], id);
+
+        for (auto it = matches.stagedBegin; it != matches.stagedEnd && !found; ++it)
+            found = it->second.find(id) != it->second.end();
+
+        if (found)
+            results[kept++] = id;
+    }
+    results.resize(kept);
 }
@@ -1,32 +1,154 @@
 // Copyright (C) 2014-2018 Manuel Schneider
 
 #pragma once
+#include <QHash>
+#include <functional>
+#include <future>
 #include <map>
 #include <memory>
 #include <set>
+#include <utility>
 #include <vector>
+#include "itemslab.h"
 #include "searchbase.h"
+#include "searchlayer.h"
+#include "termdictionary.h"
 
 namespace Core {
 
 class IndexableItem;
 
-class PrefixSearch : public SearchBase
+/**
+ * @brief The PrefixSearch class
+ * The base index, matching the query words as prefixes of the terms. An
+ * optional SearchLayer replaces the prefix matching of the terms, the items,
+ * their terms and the postings are kept here either way.
+ */
+class PrefixSearch final : public SearchBase
 {
 public:
 
     PrefixSearch();
-    PrefixSearch(const PrefixSearch &rhs);
     ~PrefixSearch();
 
     void add(const std::shared_ptr<IndexableItem> &idxble) override;
+    void remove(const std::shared_ptr<IndexableItem> &idxble) override;
+    void build() override;
+    void build(const std::vector<std::shared_ptr<IndexableItem>> &items) override;
     void clear() override;
+    void setAnalysis(uint analysis) override;
+    void save(IndexWriter &writer) override;
+    bool load(IndexReader &reader, const std::vector<std::shared_ptr<IndexableItem>> &items) override;
     std::vector<std::shared_ptr<IndexableItem>> search(const QString &req) const override;
+    std::vector<std::pair<std::shared_ptr<IndexableItem>,uint>> search(const QString &req, size_t k) const override;
+    std::vector<std::shared_ptr<IndexableItem>> search(const QString &req, Matches &previous) const override;
+    std::vector<std::pair<std::shared_ptr<IndexableItem>,uint>> search(const QString &req, size_t k, Matches &previous) const override;
+    std::vector<std::pair<uint,uint>> rank(const QString &req, size_t k, Matches *previous) const override;
+    IndexableItem *item(uint id) const override;
+    std::shared_ptr<IndexableItem> share(uint id) const override;
+    void setLayer(std::shared_ptr<SearchLayer> layer) override;
+    std::shared_ptr<SearchLayer> layer() const override;
 
-protected:
+private:
 
-    std::vector<std::shared_ptr<IndexableItem>> index_;
+    struct ItemTerm {
+        QString term;
+        uint32_t relevance;  // Maximum relevance of the index strings containing the term
+    };
+
+    struct ItemTermEntry {
+        uint32_t term;  // Position in the dictionary
+        uint32_t relevance;
+    };
+
+    /*
+     * The searches take the layer once and pass it on, since setLayer() may
+     * replace it meanwhile. Null matches the terms by prefix.
+     */
+
+    /** Sets ids to the sorted ids of the items matching all words */
+    void match(const std::set<QString> &words, std::vector<uint> &ids, const SearchLayer *layer) const;
+
+    /** Sets ids to the sorted ids of the items having terms matched by the layer for all words */
+    void matchLayer(const std::set<QString> &words, std::vector<uint> &ids, const SearchLayer &layer) const;
+
+    /** Removes the ids of the items not matching all words from the sorted ids */
+    void refineMatches(const std::set<QString> &words, std::vector<uint> &ids, const SearchLayer *layer) const;
+
+    /** Like refineMatches(), but checks the terms of the items instead of the index */
+    void filterByTerms(const std::set<QString> &words, std::vector<uint> &ids, const SearchLayer *layer) const;
+
+    /** True if the items matching extension are a subset of the ones matching word */
+    bool extends(const QString &word, const QString &extension, const SearchLayer *layer) const;
+
+    /** Returns the match quality of terms for the word, in [0,1], 0 if no match */
+    std::function<double(const QString &term)> matchQuality(const QString &word, const SearchLayer *layer) const;
+
+    /** Moves the terms of the dictionary back into the inverted index */
+    void mergeDictionary();
+
+    /** Appends the sorted ids of the items referenced by the term to ids */
+    void termPostings(const QString &term, std::vector<uint> &ids) const;
+
+    /** Removes the ids of removed items */
+    void dropRemoved(std::vector<uint> &ids) const;
+
+    // The items by id
+    ItemSlab index_;
+
+    // The terms of each item, the postings seen from the item
+    std::vector<std::vector<ItemTerm>> itemTerms_;
+
+    // Items added since the last build(), searched alongside the dictionary
     std::map<QString,std::set<uint>> invertedIndex_;
+
+    // Bulk loaded by build()
+    TermDictionary dictionary_;
+
+    // Matches the terms instead of the prefix lookup if not null. Replaced
+    // atomically, searches keep the one they started with.
+    std::shared_ptr<SearchLayer> layer_;
+
+    void tokenize(uint id);
+    void drop(uint id);
+    void compactIfSparse();
+    std::vector<std::shared_ptr<IndexableItem>> items(const std::vector<uint> &ids) const;
+    std::vector<std::pair<std::shared_ptr<IndexableItem>,uint>> items(const std::vector<std::pair<uint,uint>> &matches) const;
+    std::vector<std::pair<uint,uint>> topMatches(const std::set<QString> &words, const std::vector<uint> &ids,
+                                                 size_t k, const SearchLayer *layer) const;
+    void refine(std::set<QString> words, Matches &previous, const SearchLayer *layer, uint64_t generation) const;
+    std::vector<uint> denseIds() const;
+    void renumber(const std::vector<uint> &remap);
+    void startCompaction();
+    void adoptCompaction(bool wait);
+
+    // The ids of the items by their item id
+    QHash<QString,uint> ids_;
+
+    // The number of removed items still referenced by postings
+    size_t tombstones_ = 0;
+
+    // The dictionary without the postings of removed items, built in the
+    // background and adopted by the next modification, and the dense ids it
+    // is built with
+    std::future<TermDictionary> compaction_;
+    std::vector<uint> compactionIds_;
+    size_t compacting_ = 0;
+
+    struct WordMatches {
+        std::pair<uint,uint> postings;  // Range of posting lists in the dictionary
+        std::map<QString,std::set<uint>>::const_iterator stagedBegin;
+        std::map<QString,std::set<uint>>::const_iterator stagedEnd;
+        size_t lists;
+        size_t estimate;
+    };
+
+    void unitePostings(const WordMatches &matches, std::vector<uint> &result) const;
+    void unitePostings(const WordMatches &matches, std::vector<uint64_t> &bits) const;
+    void filterPostings(const WordMatches &matches, std::vector<uint> &results) const;
+    void intersectPostings(const WordMatches &matches, std::vector<uint> &results) const;
+    bool lookUp(const std::set<QString> &words, std::vector<WordMatches> &matches) const;
+
 };
 
 
@@ -1,10 +1,34 @@
 // Copyright (C) 2014-2018 Manuel Schneider
 
-#include <QRegularExpression>
-#include <QStringList>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
 #include <set>
+#include <thread>
+#include "albert/util/offlineindex.h"
 #include "searchbase.h"
+#include "tokenizer.h"
 using std::set;
+using std::vector;
+
+namespace {
+
+// Parallel work is not split into chunks smaller than this
+const size_t MIN_CHUNK_SIZE = 1024;
+
+std::atomic<uint64_t> lastGeneration(0);
+
+}
+
+Core::SearchBase::SearchBase()
+    : analysis_(OfflineIndex::DefaultAnalysis), generation_(++lastGeneration) {
+
+}
+
+Core::SearchBase::SearchBase(const SearchBase &other)
+    : analysis_(other.analysis_), generation_(++lastGeneration) {
+
+}
 
 Core::SearchBase::~SearchBase() {
 
@@ -13,19 +37,39 @@ Core::SearchBase::~SearchBase() {
 std::set<QString> Core::SearchBase::splitString(const QString &str) const {
 
     // Split the query into words W
-    QStringList wordlist = str.toLower().split(QRegularExpression(SEPARATOR_REGEX), QString::SkipEmptyParts);
+    thread_local vector<QString> tokens;
+    tokens.clear();
+    tokenize(str, tokens, analysis_);
+    std::sort(tokens.begin(), tokens.end());
 
-    // Make words unique
-    set<QString> words(wordlist.begin(), wordlist.end());
-
-    // Drop all words that are prefixes of others (since this an ordered set the next word)
-    for (auto it = words.begin(); it != words.end();) {
-        auto next = std::next(it);
-        if ( next != words.end() && next->startsWith(*it) )
-            it = words.erase(it);
-        else
-            ++it;
-    }
+    // Make words unique and drop all words that are prefixes of others (since
+    // the words are sorted the next word)
+    set<QString> words;
+    for (size_t i = 0; i < tokens.size(); ++i)
+        if (i + 1 == tokens.size() || !tokens[i+1].startsWith(tokens[i]))
+            words.emplace_hint(words.end(), std::move(tokens[i]));
 
     return words;
 }
+
+
+void Core::SearchBase::modified() {
+    generation_ = ++lastGeneration;
+}
+
+
+size_t Core::SearchBase::parallelChunks(size_t count) {
+    size_t threads = static_cast<size_t>(std::max(QThread::idealThreadCount(), 1));
+    return std::max<size_t>(1, std::min(threads, count / MIN_CHUNK_SIZE));
+}
+
+
+void Core::SearchBase::parallelFor(size_t chunks, const std::function<void(size_t)> &f) {
+    vector<std::thread> threads;
+    for (size_t c = 1; c < chunks; ++c)
+        threads.emplace_back(f, c);
+    if (chunks > 0)
+        f(0);
+    for (std::thread &thread : threads)
+        thread.join();
+}
@@ -2,28 +2,89 @@
 
 #pragma once
 #include <QString>
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <vector>
 #include <set>
 #include <memory>
+#include <utility>
 
 namespace Core {
 
 class IndexableItem;
+class IndexReader;
+class IndexWriter;
+class SearchLayer;
 
 class SearchBase
 {
 public:
 
+    /** The matches of a search, refined by a search extending its words */
+    struct Matches {
+        uint64_t generation = 0;  // Of the index searched
+        std::set<QString> words;
+        std::vector<uint> ids;
+    };
+
+    SearchBase();
+    SearchBase(const SearchBase &other);
     virtual ~SearchBase();
     virtual void add(const std::shared_ptr<IndexableItem> &idxble) = 0;
+    virtual void remove(const std::shared_ptr<IndexableItem> &idxble) = 0;
+    virtual void build() = 0;
+    virtual void build(const std::vector<std::shared_ptr<IndexableItem>> &items) = 0;
     virtual void clear() = 0;
     virtual std::vector<std::shared_ptr<IndexableItem>> search(const QString &req) const = 0;
+    virtual std::vector<std::pair<std::shared_ptr<IndexableItem>,uint>> search(const QString &req, size_t k) const = 0;
+
+    /** Like search() but refines the previous matches if possible, sets them to the new ones */
+    virtual std::vector<std::shared_ptr<IndexableItem>> search(const QString &req, Matches &previous) const = 0;
+    virtual std::vector<std::pair<std::shared_ptr<IndexableItem>,uint>> search(const QString &req, size_t k, Matches &previous) const = 0;
+
+    /** The ids and scores of the k best matches, best first. Refines previous if not null. */
+    virtual std::vector<std::pair<uint,uint>> rank(const QString &req, size_t k, Matches *previous) const = 0;
+
+    /** The item with the id, borrowed from the index */
+    virtual IndexableItem *item(uint id) const = 0;
+
+    /** Shares the item with the id */
+    virtual std::shared_ptr<IndexableItem> share(uint id) const = 0;
+
+    /** Builds and appends the index to the index file */
+    virtual void save(IndexWriter &writer) = 0;
+
+    /** Loads the index from the index file, the items are looked up by id */
+    virtual bool load(IndexReader &reader, const std::vector<std::shared_ptr<IndexableItem>> &items) = 0;
+
+    /** Sets the OfflineIndex::Analysis steps, reindexes the items */
+    virtual void setAnalysis(uint analysis) = 0;
+    uint analysis() const { return analysis_; }
+
+    /** Builds the layer over the terms and replaces the current one, may run
+     * concurrently with searches. Null removes the layer. */
+    virtual void setLayer(std::shared_ptr<SearchLayer> layer) = 0;
+    virtual std::shared_ptr<SearchLayer> layer() const = 0;
+
+    /** Invalidates the matches of previous searches, call on modifications */
+    void modified();
+
+    /** The number of chunks to split count elements into for parallel work */
+    static size_t parallelChunks(size_t count);
+
+    /** Calls f(chunk) for all chunks, each in its own thread */
+    static void parallelFor(size_t chunks, const std::function<void(size_t)> &f);
 
 protected:
 
     std::set<QString> splitString(const QString &) const;
 
-    static constexpr const char* SEPARATOR_REGEX  = "[!?<>\"'=+*.:,;\\\\\\/ _\\-]+";
+    // The analysis steps applied to index strings and queries
+    uint analysis_;
+
+    // Unique among all indexes and their modifications
+    std::atomic<uint64_t> generation_;
 
 };
 
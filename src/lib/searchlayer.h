@@ -0,0 +1,66 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#pragma once
+#include <QString>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace Core {
+
+class IndexReader;
+class IndexWriter;
+
+/**
+ * @brief The SearchLayer class
+ * An optional matcher over the terms of a PrefixSearch, replacing its prefix
+ * matching, e.g. by fuzzy or substring matching. The layer indexes the terms
+ * only, the items and their postings stay in the PrefixSearch. A layer is
+ * built from the terms of the base index, so toggling it neither copies nor
+ * rebuilds the base index.
+ */
+class SearchLayer
+{
+public:
+
+    enum class Type {
+        Fuzzy,
+        Substring
+    };
+
+    virtual ~SearchLayer() {}
+
+    virtual Type type() const = 0;
+
+    /** Adds a term, searchable right away but staged until freeze() */
+    virtual void add(const QString &term) = 0;
+
+    /** Adds the terms not added before in bulk and freezes the layer */
+    virtual void build(const std::vector<QString> &terms) = 0;
+
+    /** Lays out the terms staged since the last freeze() */
+    virtual void freeze() = 0;
+
+    virtual void clear() = 0;
+
+    /** Appends the layer to the index file */
+    virtual void save(IndexWriter &writer) const = 0;
+
+    /** Views the layer in the index file, false if it is invalid */
+    virtual bool load(IndexReader &reader) = 0;
+
+    /** Sets terms to the positions of the terms matching the query word */
+    virtual void match(const QString &word, std::vector<uint32_t> &terms) const = 0;
+
+    /** The term at the position */
+    virtual const QString &term(uint32_t position) const = 0;
+
+    /** True if the terms matching extension are a subset of the ones matching word */
+    virtual bool extends(const QString &word, const QString &extension) const = 0;
+
+    /** Returns the match quality of terms for the word, in [0,1], 0 if no match */
+    virtual std::function<double(const QString &term)> matchQuality(const QString &word) const = 0;
+
+};
+
+}
@@ -0,0 +1,206 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#include <algorithm>
+#include <iterator>
+#include "indexfile.h"
+#include "searchbase.h"
+#include "substringsearch.h"
+using std::vector;
+
+
+/** ***************************************************************************/
+Core::SubstringSearch::SubstringSearch() {
+
+}
+
+
+/** ***************************************************************************/
+Core::SubstringSearch::~SubstringSearch() {
+
+}
+
+
+/** ***************************************************************************/
+void Core::SubstringSearch::add(const QString &term) {
+    if (wordIds_.contains(term))
+        return;
+    wordIds_.insert(term, static_cast<uint32_t>(words_.size()));
+    words_.push_back(term);
+}
+
+
+/** ***************************************************************************/
+void Core::SubstringSearch::build(const vector<QString> &terms) {
+    for (const QString &term : terms)
+        add(term);
+    freeze();
+}
+
+
+/** ***************************************************************************/
+void Core::SubstringSearch::clear() {
+    suffixes_ = MappedArray<Suffix>();
+    sorted_ = 0;
+    wordIds_.clear();
+    words_.clear();
+}
+
+
+/** ***************************************************************************/
+void Core::SubstringSearch::save(IndexWriter &writer) const {
+
+    vector<QChar> wordChars;
+    vector<uint32_t> wordOffsets{0};
+    for (const QString &word : words_) {
+        wordChars.insert(wordChars.end(), word.cbegin(), word.cend());
+        wordOffsets.push_back(static_cast<uint32_t>(wordChars.size()));
+    }
+
+    writer.write(wordChars);
+    writer.write(wordOffsets);
+    writer.write(suffixes_);
+}
+
+
+/** ***************************************************************************
+ * @brief Reads the layer, the suffix array is used in place
+ */
+bool Core::SubstringSearch::load(IndexReader &reader) {
+
+    clear();
+
+    MappedArray<QChar> wordChars;
+    MappedArray<uint32_t> wordOffsets;
+    MappedArray<Suffix> suffixes;
+    if (!reader.read(wordChars) || !reader.read(wordOffsets) || !reader.read(suffixes)
+            || wordOffsets.empty() || wordOffsets[wordOffsets.size() - 1] != wordChars.size())
+        return false;
+
+    for (uint32_t w = 0; w + 1 < wordOffsets.size(); ++w) {
+        if (wordOffsets[w] > wordOffsets[w+1] || wordOffsets[w+1] > wordChars.size()) {
+            clear();
+            return false;
+        }
+        QString word(wordChars.data() + wordOffsets[w], static_cast<int>(wordOffsets[w+1] - wordOffsets[w]));
+        wordIds_.insert(word, w);
+        words_.push_back(std::move(word));
+    }
+
+    // Every suffix has to start within a loaded word
+    for (const Suffix &suffix : suffixes)
+        if (suffix.word >= words_.size() || suffix.offset >= static_cast<uint32_t>(words_[suffix.word].size())) {
+            clear();
+            return false;
+        }
+
+    suffixes_ = std::move(suffixes);
+    sorted_ = static_cast<uint32_t>(words_.size());
+    return true;
+}
+
+
+/** ***************************************************************************/
+void Core::SubstringSearch::match(const QString &word, vector<uint32_t> &terms) const {
+
+    // The suffixes starting with the word are contiguous
+    terms.clear();
+    auto begin = std::lower_bound(suffixes_.begin(), suffixes_.end(), word,
+                                  [this](const Suffix &s, const QString &w){ return comparePrefix(s, w) < 0; });
+    auto end = std::upper_bound(begin, suffixes_.end(), word,
+                                [this](const QString &w, const Suffix &s){ return comparePrefix(s, w) > 0; });
+    for (auto it = begin; it != end; ++it)
+        terms.push_back(it->word);
+
+    // Scan the words added since the last build
+    for (uint32_t w = sorted_; w < words_.size(); ++w)
+        if (words_[w].contains(word))
+            terms.push_back(w);
+
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+}
+
+
+/** ***************************************************************************/
+bool Core::SubstringSearch::extends(const QString &word, const QString &extension) const {
+    return extension.contains(word);
+}
+
+
+/** ***************************************************************************
+ * @brief A term containing the word matches by the share of the term the word
+ * covers, halved if the word is not a prefix of the term.
+ */
+std::function<double(const QString &)> Core::SubstringSearch::matchQuality(const QString &word) const {
+    return [word](const QString &term){
+        int position = term.indexOf(word);
+        if (position < 0)
+            return 0.0;
+        double quality = static_cast<double>(word.size()) / term.size();
+        return (position == 0) ? quality : quality / 2;
+    };
+}
+
+
+/** ***************************************************************************
+ * @brief Sorts the suffixes of the words added since the last build in
+ * parallel chunks and merges them into the suffix array.
+ */
+void Core::SubstringSearch::freeze() {
+
+    if (sorted_ == words_.size())
+        return;
+
+    vector<Suffix> added;
+    for (uint32_t w = sorted_; w < words_.size(); ++w)
+        for (uint32_t offset = 0; offset < static_cast<uint32_t>(words_[w].size()); ++offset)
+            added.push_back({w, offset});
+
+    // Identical suffixes are ordered by position, for a deterministic order
+    auto less = [this](const Suffix &l, const Suffix &r){
+        const QChar *a = words_[l.word].unicode() + l.offset, *b = words_[r.word].unicode() + r.offset;
+        int lengthA = words_[l.word].size() - static_cast<int>(l.offset);
+        int lengthB = words_[r.word].size() - static_cast<int>(r.offset);
+        for (int i = 0; i < std::min(lengthA, lengthB); ++i)
+            if (a[i] != b[i])
+                return a[i] < b[i];
+        if (lengthA != lengthB)
+            return lengthA < lengthB;
+        return l.word < r.word || (l.word == r.word && l.offset < r.offset);
+    };
+
+    size_t chunks = SearchBase::parallelChunks(added.size());
+    SearchBase::parallelFor(chunks, [&](size_t c){
+        std::sort(added.begin() + static_cast<long>(added.size() * c / chunks),
+                  added.begin() + static_cast<long>(added.size() * (c + 1) / chunks), less);
+    });
+    for (size_t c = 1; c < chunks; ++c)
+        std::inplace_merge(added.begin(),
+                           added.begin() + static_cast<long>(added.size() * c / chunks),
+                           added.begin() + static_cast<long>(added.size() * (c + 1) / chunks), less);
+
+    vector<Suffix> suffixes;
+    suffixes.reserve(suffixes_.size() + added.size());
+    std::merge(suffixes_.begin(), suffixes_.end(), added.begin(), added.end(),
+               std::back_inserter(suffixes), less);
+
+    suffixes_ = MappedArray<Suffix>(std::move(suffixes));
+    sorted_ = static_cast<uint32_t>(words_.size());
+}
+
+
+/** ***************************************************************************
+ * @brief Compares the suffix to the prefix, 0 if the suffix starts with it
+ */
+int Core::SubstringSearch::comparePrefix(const Suffix &suffix, const QString &prefix) const {
+    const QString &word = words_[suffix.word];
+    const QChar *chars = word.unicode() + suffix.offset;
+    int length = word.size() - static_cast<int>(suffix.offset);
+    for (int i = 0; i < prefix.size(); ++i) {
+        if (i == length)
+            return -1;
+        if (chars[i] != prefix[i])
+            return chars[i] < prefix[i] ? -1 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#pragma once
+#include <QHash>
+#include <QString>
+#include <cstdint>
+#include <vector>
+#include "mappedarray.h"
+#include "searchlayer.h"
+
+namespace Core {
+
+/**
+ * @brief The SubstringSearch class
+ * A layer matching query words anywhere in the terms, e.g. "report" in
+ * "q3report". The suffixes of all terms are kept in a suffix array, the terms
+ * containing a query word are a contiguous range of it, found by binary
+ * search.
+ */
+class SubstringSearch final : public SearchLayer
+{
+public:
+
+    SubstringSearch();
+    ~SubstringSearch();
+
+    Type type() const override { return Type::Substring; }
+    void add(const QString &term) override;
+    void build(const std::vector<QString> &terms) override;
+    void freeze() override;
+    void clear() override;
+    void save(IndexWriter &writer) const override;
+    bool load(IndexReader &reader) override;
+    void match(const QString &word, std::vector<uint32_t> &terms) const override;
+    const QString &term(uint32_t position) const override { return words_[position]; }
+    bool extends(const QString &word, const QString &extension) const override;
+    std::function<double(const QString &term)> matchQuality(const QString &word) const override;
+
+private:
+
+    struct Suffix {
+        uint32_t word;
+        uint32_t offset;
+    };
+
+    int comparePrefix(const Suffix &suffix, const QString &prefix) const;
+
+    // The words of the index, referenced by their position
+    std::vector<QString> words_;
+    QHash<QString,uint32_t> wordIds_;
+
+    // The suffixes of the words added up to the last build(), sorted. Words
+    // added since are scanned.
+    MappedArray<Suffix> suffixes_;
+    uint32_t sorted_ = 0;
+
+};
+
+}
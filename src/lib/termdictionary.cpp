@@ -0,0 +1,398 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#include <QtAlgorithms>
+#include <algorithm>
+#include <unordered_map>
+#include "indexfile.h"
+#include "termdictionary.h"
+using std::map;
+using std::pair;
+using std::set;
+using std::vector;
+
+namespace {
+
+// Posting lists shorter than this are never stored as bitmap
+const uint32_t BITMAP_MIN_COUNT = 64;
+
+// Posting lists are stored as bitmap if at least every n-th id in their span
+// is set. The varint deltas take a byte per id at that density.
+const uint32_t BITMAP_MAX_SPARSITY = 8;
+
+}
+
+
+/*
+ * The growing arrays of a dictionary under construction
+ */
+struct Core::TermDictionary::Builder
+{
+    vector<QChar> chars;
+    vector<uint32_t> termOffsets;
+    vector<Postings> postings;
+    vector<uint8_t> bytes;
+    vector<PostingSkip> skips;
+    vector<uint64_t> bitmaps;
+
+    uint32_t addPostings(const vector<uint32_t> &ids);
+    vector<ShortPrefix> buildShortPrefixes();
+};
+
+
+/** ***************************************************************************/
+Core::TermDictionary::TermDictionary() : termOffsets_(vector<uint32_t>(1, 0)) {
+
+}
+
+
+/** ***************************************************************************
+ * @brief Lays out the terms and their posting lists flat. The terms have to
+ * be sorted and unique, their ids sorted and unique.
+ */
+template<class Terms>
+void Core::TermDictionary::layout(const Terms &terms) {
+
+    size_t charCount = 0, postingCount = 0;
+    for (const auto &entry : terms) {
+        charCount += static_cast<size_t>(entry.first.size());
+        postingCount += entry.second.size();
+    }
+
+    Builder builder;
+    builder.chars.reserve(charCount);
+    builder.bytes.reserve(postingCount * 2);
+    builder.termOffsets.reserve(terms.size() + 1);
+    builder.postings.reserve(terms.size());
+
+    vector<uint32_t> ids;
+    builder.termOffsets.push_back(0);
+    for (const auto &entry : terms) {
+        builder.chars.insert(builder.chars.end(), entry.first.cbegin(), entry.first.cend());
+        builder.termOffsets.push_back(static_cast<uint32_t>(builder.chars.size()));
+        ids.assign(entry.second.begin(), entry.second.end());
+        builder.addPostings(ids);
+    }
+
+    vector<ShortPrefix> shortPrefixes = builder.buildShortPrefixes();
+    builder.bytes.shrink_to_fit();
+
+    chars_ = MappedArray<QChar>(std::move(builder.chars));
+    termOffsets_ = MappedArray<uint32_t>(std::move(builder.termOffsets));
+    postings_ = MappedArray<Postings>(std::move(builder.postings));
+    bytes_ = MappedArray<uint8_t>(std::move(builder.bytes));
+    skips_ = MappedArray<PostingSkip>(std::move(builder.skips));
+    bitmaps_ = MappedArray<uint64_t>(std::move(builder.bitmaps));
+    shortPrefixes_ = MappedArray<ShortPrefix>(std::move(shortPrefixes));
+}
+
+
+/** ***************************************************************************/
+Core::TermDictionary::TermDictionary(const map<QString, set<uint>> &invertedIndex) {
+    layout(invertedIndex);
+}
+
+
+/** ***************************************************************************/
+Core::TermDictionary::TermDictionary(const vector<pair<QString, vector<uint32_t>>> &terms) {
+    layout(terms);
+}
+
+
+/** ***************************************************************************/
+void Core::TermDictionary::save(IndexWriter &writer) const {
+    writer.write(chars_);
+    writer.write(termOffsets_);
+    writer.write(postings_);
+    writer.write(bytes_);
+    writer.write(skips_);
+    writer.write(bitmaps_);
+    writer.write(shortPrefixes_);
+}
+
+
+/** ***************************************************************************
+ * @brief Uses the arrays of the dictionary in place in the mapped file. The
+ * file is not checksummed on load, so the offsets into the arrays are checked
+ * before they are used.
+ * @param ids The number of item ids the posting lists may reference
+ * @return False if the file does not hold a dictionary
+ */
+bool Core::TermDictionary::load(IndexReader &reader, uint ids) {
+
+    if (!reader.read(chars_)
+            || !reader.read(termOffsets_)
+            || !reader.read(postings_)
+            || !reader.read(bytes_)
+            || !reader.read(skips_)
+            || !reader.read(bitmaps_)
+            || !reader.read(shortPrefixes_)
+            || termOffsets_.empty()
+            || termOffsets_[0] != 0
+            || termOffsets_[termOffsets_.size() - 1] != chars_.size()
+            || postings_.size() < size())
+        return false;
+
+    for (uint i = 0; i < size(); ++i)
+        if (termOffsets_[i] > termOffsets_[i+1])
+            return false;
+
+    uint32_t idWords = (ids + 63) / 64;
+    for (const Postings &p : postings_) {
+        if (p.words > 0) {
+            // Bitmaps are OR-ed into bitmaps spanning the ids
+            if (p.offset > bitmaps_.size() || p.words > bitmaps_.size() - p.offset
+                    || p.skips > idWords || p.words > idWords - p.skips)
+                return false;
+            // No bit may be set past the last id
+            if (ids % 64 != 0 && p.skips + p.words == idWords
+                    && bitmaps_[p.offset + p.words - 1] >> (ids % 64))
+                return false;
+        } else {
+            // Every id takes at least a byte
+            uint32_t skips = p.count > 0 ? (p.count - 1) / SKIP_INTERVAL : 0;
+            if (p.offset > bytes_.size() || p.count > bytes_.size() - p.offset
+                    || p.skips > skips_.size() || skips > skips_.size() - p.skips
+                    || !checkPostings(bytes_.data() + p.offset, bytes_.data() + bytes_.size(),
+                                      bytes_.data(), skips_.data() + p.skips, p.count, ids))
+                return false;
+        }
+    }
+
+    for (const ShortPrefix &prefix : shortPrefixes_)
+        if (prefix.first > prefix.last || prefix.last > size() || prefix.list >= postings_.size())
+            return false;
+
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Appends a posting list, as bitmap if that is denser
+ * @return The id of the list
+ */
+uint32_t Core::TermDictionary::Builder::addPostings(const vector<uint32_t> &ids) {
+    Postings p;
+    p.count = static_cast<uint32_t>(ids.size());
+    uint32_t firstWord = ids.front() / 64, lastWord = ids.back() / 64;
+    if (p.count >= BITMAP_MIN_COUNT && p.count * BITMAP_MAX_SPARSITY >= (lastWord - firstWord + 1) * 64) {
+        p.offset = static_cast<uint32_t>(bitmaps.size());
+        p.skips = firstWord;
+        p.words = lastWord - firstWord + 1;
+        bitmaps.resize(bitmaps.size() + p.words, 0);
+        uint64_t *bitmap = bitmaps.data() + p.offset;
+        for (uint32_t id : ids)
+            bitmap[id / 64 - firstWord] |= uint64_t(1) << (id % 64);
+    } else {
+        p.offset = static_cast<uint32_t>(bytes.size());
+        p.skips = static_cast<uint32_t>(skips.size());
+        p.words = 0;
+        encodePostings(ids.data(), ids.data() + ids.size(), bytes, skips);
+    }
+    postings.push_back(p);
+    return static_cast<uint32_t>(postings.size() - 1);
+}
+
+
+/** ***************************************************************************
+ * @brief Precomputes the term ranges and united posting lists of all prefixes
+ * of one and two characters, the first keystrokes of every query.
+ * @return The prefixes, sorted by key
+ */
+vector<Core::TermDictionary::ShortPrefix> Core::TermDictionary::Builder::buildShortPrefixes() {
+
+    // Terms sharing a prefix are contiguous, extend the range of each prefix
+    std::unordered_map<uint64_t,ShortPrefix> prefixes;
+    for (uint i = 0; i + 1 < termOffsets.size(); ++i) {
+        const QChar *term = chars.data() + termOffsets[i];
+        uint length = termOffsets[i+1] - termOffsets[i];
+        for (uint l = 1; l <= std::min(length, 2u); ++l) {
+            uint64_t key = shortPrefixKey(term, l);
+            auto it = prefixes.emplace(key, ShortPrefix{key, i, i, i, 0}).first;
+            it->second.last = i + 1;
+        }
+    }
+
+    // Unite the lists of prefixes spanning several terms
+    vector<uint32_t> ids;
+    vector<ShortPrefix> result;
+    result.reserve(prefixes.size());
+    for (auto &entry : prefixes) {
+        ShortPrefix &prefix = entry.second;
+        if (prefix.last - prefix.first > 1) {
+            ids.clear();
+            for (uint i = prefix.first; i < prefix.last; ++i)
+                appendPostings(postings[i], bytes.data(), bitmaps.data(), ids);
+            std::sort(ids.begin(), ids.end());
+            ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+            prefix.list = addPostings(ids);
+        }
+        result.push_back(prefix);
+    }
+
+    std::sort(result.begin(), result.end(), [](const ShortPrefix &l, const ShortPrefix &r){
+        return l.key < r.key;
+    });
+    return result;
+}
+
+
+/** ***************************************************************************/
+uint64_t Core::TermDictionary::shortPrefixKey(const QChar *prefix, uint length) {
+    uint64_t key = static_cast<uint64_t>(length) << 32 | static_cast<uint64_t>(prefix[0].unicode()) << 16;
+    if (length > 1)
+        key |= prefix[1].unicode();
+    return key;
+}
+
+
+/** ***************************************************************************/
+const Core::TermDictionary::ShortPrefix *Core::TermDictionary::findShortPrefix(const QString &prefix) const {
+    uint64_t key = shortPrefixKey(prefix.unicode(), static_cast<uint>(prefix.size()));
+    auto it = std::lower_bound(shortPrefixes_.begin(), shortPrefixes_.end(), key,
+                               [](const ShortPrefix &p, uint64_t k){ return p.key < k; });
+    return (it != shortPrefixes_.end() && it->key == key) ? it : nullptr;
+}
+
+
+/** ***************************************************************************/
+QString Core::TermDictionary::term(uint i) const {
+    return QString(chars_.data() + termOffsets_[i],
+                   static_cast<int>(termOffsets_[i+1] - termOffsets_[i]));
+}
+
+
+/** ***************************************************************************/
+uint Core::TermDictionary::find(const QString &term) const {
+    // If present, the term is the first of the terms it prefixes
+    pair<uint,uint> range = prefixRange(term);
+    if (range.first < range.second
+            && termOffsets_[range.first+1] - termOffsets_[range.first] == static_cast<uint>(term.size()))
+        return range.first;
+    return size();
+}
+
+
+/** ***************************************************************************/
+Core::PostingIterator Core::TermDictionary::postings(uint list) const {
+    const Postings &p = postings_[list];
+    return PostingIterator(bytes_.data() + p.offset, bytes_.data(), skips_.data() + p.skips, p.count);
+}
+
+
+/** ***************************************************************************/
+bool Core::TermDictionary::bitmapContains(uint list, uint32_t id) const {
+    const Postings &p = postings_[list];
+    uint32_t word = id / 64;
+    if (word < p.skips || word >= p.skips + p.words)
+        return false;
+    return bitmaps_[p.offset + word - p.skips] & (uint64_t(1) << (id % 64));
+}
+
+
+/** ***************************************************************************/
+void Core::TermDictionary::appendPostings(uint list, vector<uint32_t> &out) const {
+    appendPostings(postings_[list], bytes_.data(), bitmaps_.data(), out);
+}
+
+
+/** ***************************************************************************/
+void Core::TermDictionary::appendPostings(const Postings &p, const uint8_t *bytes,
+                                          const uint64_t *bitmaps, vector<uint32_t> &out) {
+    if (p.words == 0) {
+        decodePostings(bytes + p.offset, p.count, out);
+        return;
+    }
+    const uint64_t *bitmap = bitmaps + p.offset;
+    for (uint32_t w = 0; w < p.words; ++w)
+        for (uint64_t word = bitmap[w]; word; word &= word - 1)
+            out.push_back((p.skips + w) * 64 + qCountTrailingZeroBits(word));
+}
+
+
+/** ***************************************************************************/
+void Core::TermDictionary::unitePostings(uint list, uint64_t *bits) const {
+    const Postings &p = postings_[list];
+    if (p.words == 0) {
+        PostingIterator it = postings(list);
+        for (; !it.atEnd(); it.next())
+            bits[it.value() / 64] |= uint64_t(1) << (it.value() % 64);
+        return;
+    }
+    // Word level OR, this vectorizes
+    const uint64_t *bitmap = bitmaps_.data() + p.offset;
+    uint64_t *dst = bits + p.skips;
+    for (uint32_t w = 0; w < p.words; ++w)
+        dst[w] |= bitmap[w];
+}
+
+
+/** ***************************************************************************/
+pair<uint, uint> Core::TermDictionary::prefixRange(const QString &prefix) const {
+
+    uint length = static_cast<uint>(prefix.size());
+    if (length > 0 && length <= 2) {
+        const ShortPrefix *shortPrefix = findShortPrefix(prefix);
+        if (!shortPrefix)
+            return {0, 0};
+        return {shortPrefix->first, shortPrefix->last};
+    }
+
+    // Terms starting with prefix form a contiguous block in the sorted terms
+    uint first = 0, count = size();
+    while (count > 0) {
+        uint step = count / 2;
+        if (comparePrefix(first + step, prefix) < 0) {
+            first += step + 1;
+            count -= step + 1;
+        } else
+            count = step;
+    }
+
+    uint last = first;
+    count = size() - first;
+    while (count > 0) {
+        uint step = count / 2;
+        if (comparePrefix(last + step, prefix) == 0) {
+            last += step + 1;
+            count -= step + 1;
+        } else
+            count = step;
+    }
+
+    return {first, last};
+}
+
+
+/** ***************************************************************************/
+pair<uint, uint> Core::TermDictionary::prefixPostings(const QString &prefix) const {
+
+    uint length = static_cast<uint>(prefix.size());
+    if (length > 0 && length <= 2) {
+        const ShortPrefix *shortPrefix = findShortPrefix(prefix);
+        if (!shortPrefix)
+            return {0, 0};
+        return {shortPrefix->list, shortPrefix->list + 1};
+    }
+
+    return prefixRange(prefix);
+}
+
+
+/** ***************************************************************************
+ * @brief Compares the term at position i, truncated to the length of the
+ * prefix, to the prefix. Ordering is by UTF-16 code units, like QString.
+ * @return <0, 0 or >0 like strcmp, 0 meaning the term starts with prefix
+ */
+int Core::TermDictionary::comparePrefix(uint i, const QString &prefix) const {
+    const QChar *term = chars_.data() + termOffsets_[i];
+    uint termLength = termOffsets_[i+1] - termOffsets_[i];
+    uint prefixLength = static_cast<uint>(prefix.size());
+    const QChar *p = prefix.unicode();
+
+    uint length = std::min(termLength, prefixLength);
+    for (uint k = 0; k < length; ++k)
+        if (term[k] != p[k])
+            return term[k].unicode() < p[k].unicode() ? -1 : 1;
+
+    return termLength < prefixLength ? -1 : 0;
+}
@@ -0,0 +1,123 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#pragma once
+#include <QChar>
+#include <QString>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+#include "mappedarray.h"
+#include "postinglist.h"
+
+namespace Core {
+
+class IndexReader;
+class IndexWriter;
+
+/**
+ * @brief The TermDictionary class
+ * An immutable, sorted term dictionary. The terms are stored back to back in a
+ * single character array and the compressed posting lists (sorted item ids) of
+ * all terms share a single byte arena. Lookups are binary searches over
+ * contiguous memory. Like the containers of a roaring bitmap, posting lists of
+ * frequent terms are stored as bitmaps instead, if that is denser.
+ *
+ * Posting lists are addressed by list ids. The list of the term at position i
+ * has the id i. For every prefix of one or two characters the dictionary holds
+ * the term range and, if it spans more than one term, a precomputed list
+ * uniting the ids of all its terms.
+ *
+ * All arrays are flat and free of pointers, a saved dictionary is used in
+ * place in the mapped index file.
+ */
+class TermDictionary
+{
+public:
+
+    TermDictionary();
+    explicit TermDictionary(const std::map<QString,std::set<uint>> &invertedIndex);
+    explicit TermDictionary(const std::vector<std::pair<QString,std::vector<uint32_t>>> &terms);
+
+    /** Appends the dictionary to the index file */
+    void save(IndexWriter &writer) const;
+
+    /** Views the dictionary in the index file, false if it is invalid or
+     * references ids not less than ids */
+    bool load(IndexReader &reader, uint ids);
+
+    /** The number of terms in the dictionary */
+    uint size() const { return static_cast<uint>(termOffsets_.size()) - 1; }
+
+    /** True if there are no terms in the dictionary */
+    bool empty() const { return size() == 0; }
+
+    /** The term at position i */
+    QString term(uint i) const;
+
+    /** The position of the term, size() if not found */
+    uint find(const QString &term) const;
+
+    /** The number of items in the posting list */
+    uint32_t postingCount(uint list) const { return postings_[list].count; }
+
+    /** True if the posting list is a bitmap */
+    bool isBitmap(uint list) const { return postings_[list].words > 0; }
+
+    /** True if the bitmap posting list contains the id */
+    bool bitmapContains(uint list, uint32_t id) const;
+
+    /** A cursor over the sorted item ids of the posting list (no bitmap) */
+    PostingIterator postings(uint list) const;
+
+    /** Appends the sorted item ids of the posting list to out */
+    void appendPostings(uint list, std::vector<uint32_t> &out) const;
+
+    /** Sets the bits of the item ids of the posting list in bits */
+    void unitePostings(uint list, uint64_t *bits) const;
+
+    /** The range [first, last) of the terms starting with prefix */
+    std::pair<uint,uint> prefixRange(const QString &prefix) const;
+
+    /** The range [first, last) of the posting lists uniting to the ids of the
+     * terms starting with prefix. A single list for short prefixes. */
+    std::pair<uint,uint> prefixPostings(const QString &prefix) const;
+
+private:
+
+    struct Builder;
+
+    struct ShortPrefix {
+        uint64_t key;
+        uint32_t first;
+        uint32_t last;
+        uint32_t list;
+        uint32_t reserved;
+    };
+
+    struct Postings {
+        uint32_t offset;  // Byte offset or, if bitmap, word offset
+        uint32_t count;
+        uint32_t skips;   // First skip pointer or, if bitmap, first word of the id space
+        uint32_t words;   // Length of the bitmap, 0 if compressed
+    };
+
+    template<class Terms> void layout(const Terms &terms);
+    static uint64_t shortPrefixKey(const QChar *prefix, uint length);
+    static void appendPostings(const Postings &p, const uint8_t *bytes,
+                               const uint64_t *bitmaps, std::vector<uint32_t> &out);
+    const ShortPrefix *findShortPrefix(const QString &prefix) const;
+    int comparePrefix(uint i, const QString &prefix) const;
+
+    MappedArray<QChar> chars_;
+    MappedArray<uint32_t> termOffsets_;
+    MappedArray<Postings> postings_;
+    MappedArray<uint8_t> bytes_;
+    MappedArray<PostingSkip> skips_;
+    MappedArray<uint64_t> bitmaps_;
+    MappedArray<ShortPrefix> shortPrefixes_;
+
+};
+
+}
@@ -0,0 +1,136 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#include <QChar>
+#include <array>
+#include <vector>
+#include "albert/util/offlineindex.h"
+#include "tokenizer.h"
+using std::array;
+using std::vector;
+
+namespace {
+
+const char SEPARATORS[] = "!?<>\"'=+*.:,;\\/ _-";
+
+const uint ANALYSIS_STEPS = Core::OfflineIndex::CaseFolding
+                            | Core::OfflineIndex::Normalization
+                            | Core::OfflineIndex::DiacriticFolding;
+
+// Marks a Latin-1 character whose analysis is not a single Latin-1 character
+const ushort COMPLEX = 0xffff;
+
+// The analyzed Latin-1 characters for every combination of analysis steps,
+// 0 for separators
+const array<array<ushort,256>,ANALYSIS_STEPS+1> LATIN1 = [](){
+    array<array<ushort,256>,ANALYSIS_STEPS+1> tables;
+    for (uint analysis = 0; analysis <= ANALYSIS_STEPS; ++analysis) {
+        array<ushort,256> &table = tables[analysis];
+        for (ushort c = 0; c < 256; ++c) {
+            QString analyzed = Core::analyze(QString(QChar(c)), analysis);
+            table[c] = (analyzed.size() == 1 && analyzed[0].unicode() < 256) ? analyzed[0].unicode() : COMPLEX;
+        }
+        for (const char *s = SEPARATORS; *s; ++s)
+            table[static_cast<uchar>(*s)] = 0;
+    }
+    return tables;
+}();
+
+}
+
+
+/** ***************************************************************************/
+void Core::tokenize(const QString &string, vector<QString> &tokens, uint analysis) {
+
+    const array<ushort,256> &latin1 = LATIN1[analysis & ANALYSIS_STEPS];
+
+    // The analyzed units of the current token
+    thread_local vector<QChar> buffer;
+    buffer.resize(static_cast<size_t>(string.size()));
+
+    const QChar *chars = string.unicode();
+    int begin = 0;
+    size_t length = 0;
+    bool simple = true;
+    auto flush = [&](int end){
+        if (length > 0) {
+            QString token = simple ? QString(buffer.data(), static_cast<int>(length))
+                                   : analyze(QString(chars + begin, end - begin), analysis);
+            // Tokens of diacritics only vanish
+            if (!token.isEmpty())
+                tokens.push_back(std::move(token));
+        }
+        begin = end + 1;
+        length = 0;
+        simple = true;
+    };
+
+    for (int i = 0; i < string.size(); ++i) {
+        ushort c = chars[i].unicode();
+        ushort analyzed = (c < 256) ? latin1[c] : COMPLEX;
+        if (analyzed == 0)
+            flush(i);
+        else {
+            buffer[length++] = QChar(analyzed);
+            simple = simple && analyzed != COMPLEX;
+        }
+    }
+    flush(string.size());
+}
+
+
+/** ***************************************************************************
+ * @brief A camel case part starts at an uppercase letter following a lowercase
+ * one, or followed by a lowercase one in a run of uppercase letters, e.g.
+ * "XMLParser" -> "XML", "Parser".
+ */
+void Core::acronyms(const QString &string, vector<QString> &acronyms, uint analysis) {
+
+    const array<ushort,256> &latin1 = LATIN1[0];
+    const QChar *chars = string.unicode();
+    const int size = string.size();
+
+    QString wordInitials, partInitials;
+    for (int i = 0; i < size; ++i) {
+        ushort c = chars[i].unicode();
+        if (c < 256 && latin1[c] == 0)
+            continue;
+
+        bool wordStart = i == 0 || (chars[i-1].unicode() < 256 && latin1[chars[i-1].unicode()] == 0);
+        if (wordStart)
+            wordInitials.append(chars[i]);
+        if (wordStart
+                || (chars[i].isUpper() && chars[i-1].isLower())
+                || (chars[i].isUpper() && chars[i-1].isUpper() && i + 1 < size && chars[i+1].isLower()))
+            partInitials.append(chars[i]);
+    }
+
+    if (wordInitials.size() > 1)
+        acronyms.push_back(analyze(wordInitials, analysis));
+    if (partInitials.size() > 1 && partInitials.size() > wordInitials.size())
+        acronyms.push_back(analyze(partInitials, analysis));
+}
+
+
+/** ***************************************************************************
+ * @brief Case folds first, since folding may yield decomposable characters,
+ * e.g. "İ" -> "i̇"
+ */
+QString Core::analyze(const QString &token, uint analysis) {
+
+    QString result = (analysis & OfflineIndex::CaseFolding) ? token.toCaseFolded() : token.toLower();
+
+    if (analysis & OfflineIndex::Normalization)
+        result = result.normalized(QString::NormalizationForm_KD);
+    else if (analysis & OfflineIndex::DiacriticFolding)
+        result = result.normalized(QString::NormalizationForm_D);
+
+    if (analysis & OfflineIndex::DiacriticFolding) {
+        int length = 0;
+        for (int i = 0; i < result.size(); ++i)
+            if (result[i].category() != QChar::Mark_NonSpacing)
+                result[length++] = result[i];
+        result.truncate(length);
+    }
+
+    return result;
+}
@@ -0,0 +1,33 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#pragma once
+#include <QString>
+#include <vector>
+
+namespace Core {
+
+/**
+ * @brief Splits the string into analyzed tokens
+ * Tokens are separated by runs of the characters !?<>"'=+*.:,;\/ _- and
+ * analyzed by the steps of OfflineIndex::Analysis, i.e. lowercased or case
+ * folded, decomposed and stripped of their diacritics. The tokens are appended
+ * to tokens, in order of their appearance.
+ *
+ * A single pass over the UTF-16 units, separator detection and the analysis
+ * of Latin-1 characters are table lookups. Tokens containing other characters
+ * are analyzed by Qt.
+ */
+void tokenize(const QString &string, std::vector<QString> &tokens, uint analysis);
+
+/**
+ * @brief Appends the acronyms of the string to acronyms
+ * The acronyms are the initials of the tokens and, if there are camel case
+ * parts, e.g. "LibreOffice", the initials of the parts, analyzed like tokens.
+ * Acronyms shorter than two characters are skipped.
+ */
+void acronyms(const QString &string, std::vector<QString> &acronyms, uint analysis);
+
+/** Analyzes a single token by the steps of OfflineIndex::Analysis */
+QString analyze(const QString &token, uint analysis);
+
+}
@@ -0,0 +1,381 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#include <QString>
+#include <QTemporaryDir>
+#include <QTest>
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <vector>
+#include "albert/util/offlineindex.h"
+#include "albert/util/standardindexitem.h"
+using Core::IndexableItem;
+using Core::OfflineIndex;
+using Core::StandardIndexItem;
+using std::map;
+using std::set;
+using std::shared_ptr;
+using std::vector;
+
+namespace {
+
+enum class Mode { Prefix, Fuzzy, Substring };
+
+const QString SEPARATORS("!?<>\"'=+*.:,;\\/ _-");
+
+shared_ptr<IndexableItem> makeItem(const QString &id, const QString &text) {
+    auto item = std::make_shared<StandardIndexItem>(id);
+    item->setText(text);
+    item->setIndexKeywords({IndexableItem::IndexString(text, UINT_MAX)});
+    return item;
+}
+
+// Splits at the separators and lowercases, the DefaultAnalysis of ASCII
+vector<QString> words(const QString &string) {
+    vector<QString> words;
+    QString word;
+    for (QChar c : string + QChar(' ')) {
+        if (!SEPARATORS.contains(c)) {
+            word.append(c.toLower());
+        } else if (!word.isEmpty()) {
+            words.push_back(word);
+            word.clear();
+        }
+    }
+    return words;
+}
+
+// The edit distance of the word to the closest prefix of the term
+uint prefixEditDistance(const QString &word, const QString &term) {
+    vector<uint> row(static_cast<size_t>(term.size()) + 1), next(row.size());
+    for (size_t j = 0; j < row.size(); ++j)
+        row[j] = static_cast<uint>(j);
+    for (int i = 1; i <= word.size(); ++i) {
+        next[0] = static_cast<uint>(i);
+        for (int j = 1; j <= term.size(); ++j)
+            next[static_cast<size_t>(j)] = std::min({row[static_cast<size_t>(j-1)] + (word[i-1] == term[j-1] ? 0 : 1),
+                                                     row[static_cast<size_t>(j)] + 1,
+                                                     next[static_cast<size_t>(j-1)] + 1});
+        row.swap(next);
+    }
+    return *std::min_element(row.begin(), row.end());
+}
+
+/*
+ * The naive search the index has to agree with: an item matches if every word
+ * of the query matches any of its terms
+ */
+class Reference
+{
+public:
+
+    explicit Reference(Mode mode, uint delta = 1) : mode_(mode), delta_(delta) { }
+
+    void add(const QString &id, const QString &text) { terms_[id] = words(text); }
+    void remove(const QString &id) { terms_.erase(id); }
+
+    set<QString> search(const QString &query) const {
+        set<QString> results;
+        vector<QString> queryWords = words(query);
+        if (queryWords.empty())
+            return results;
+        for (const auto &entry : terms_)
+            if (std::all_of(queryWords.cbegin(), queryWords.cend(), [&](const QString &word){
+                    return std::any_of(entry.second.cbegin(), entry.second.cend(), [&](const QString &term){
+                        return matches(word, term); }); }))
+                results.insert(entry.first);
+        return results;
+    }
+
+private:
+
+    bool matches(const QString &word, const QString &term) const {
+        switch (mode_) {
+        case Mode::Prefix:
+            return term.startsWith(word);
+        case Mode::Fuzzy:
+            return prefixEditDistance(word, term) <= delta_;
+        case Mode::Substring:
+            return term.contains(word);
+        }
+        return false;
+    }
+
+    Mode mode_;
+    uint delta_;
+    map<QString, vector<QString>> terms_;
+
+};
+
+set<QString> ids(const vector<shared_ptr<IndexableItem>> &items) {
+    set<QString> ids;
+    for (const auto &item : items)
+        ids.insert(item->id());
+    return ids;
+}
+
+// Texts and queries over a small alphabet, so that words share prefixes,
+// substrings and qGrams
+class Corpus
+{
+public:
+
+    explicit Corpus(uint seed) : rng_(seed) {
+        for (int i = 0; i < 300; ++i)
+            vocabulary_.push_back(randomWord(2 + static_cast<int>(rng_() % 7)));
+    }
+
+    QString text() {
+        QString text;
+        int count = 1 + static_cast<int>(rng_() % 4);
+        for (int w = 0; w < count; ++w) {
+            if (w > 0)
+                text.append(SEPARATORS[static_cast<int>(rng_() % static_cast<uint>(SEPARATORS.size()))]);
+            QString word = vocabulary_[rng_() % vocabulary_.size()];
+            if (rng_() % 4 == 0)
+                word[0] = word[0].toUpper();
+            text.append(word);
+        }
+        return text;
+    }
+
+    // One or two words, prefixes of vocabulary words, some misspelled
+    QString query() {
+        QString query;
+        int count = 1 + static_cast<int>(rng_() % 2);
+        for (int w = 0; w < count; ++w) {
+            QString word = vocabulary_[rng_() % vocabulary_.size()];
+            word.truncate(1 + static_cast<int>(rng_() % static_cast<uint>(word.size())));
+            if (word.size() > 2 && rng_() % 3 == 0)
+                word[static_cast<int>(rng_() % static_cast<uint>(word.size()))] = QChar('a' + static_cast<int>(rng_() % 6));
+            if (w > 0)
+                query.append(' ');
+            query.append(word);
+        }
+        return query;
+    }
+
+    uint random(uint bound) { return rng_() % bound; }
+
+private:
+
+    QString randomWord(int length) {
+        QString word;
+        for (int i = 0; i < length; ++i)
+            word.append(QChar('a' + static_cast<int>(rng_() % 6)));
+        return word;
+    }
+
+    std::mt19937 rng_;
+    vector<QString> vocabulary_;
+
+};
+
+void setMode(OfflineIndex &index, Mode mode) {
+    if (mode == Mode::Fuzzy) {
+        index.setFuzzy();
+        index.setDelta(1);
+    } else if (mode == Mode::Substring) {
+        index.setSubstring();
+    }
+}
+
+}
+
+
+class OfflineIndexTest : public QObject
+{
+    Q_OBJECT
+
+private:
+
+    // Compares all kinds of searches of the query to the reference
+    void compare(const OfflineIndex &index, const Reference &reference, const QString &query) {
+        set<QString> expected = reference.search(query);
+        QCOMPARE(ids(index.search(query)), expected);
+
+        // The k best matches are matches, best first
+        for (size_t k : {size_t(1), size_t(5), size_t(UINT_MAX)}) {
+            auto ranked = index.search(query, k);
+            QCOMPARE(ranked.size(), std::min(k, expected.size()));
+            for (size_t i = 0; i < ranked.size(); ++i) {
+                QVERIFY(expected.count(ranked[i].first->id()) == 1);
+                QVERIFY(i == 0 || ranked[i-1].second >= ranked[i].second);
+            }
+        }
+    }
+
+    void compareSearches(Mode mode) {
+        Corpus corpus(static_cast<uint>(mode) + 1);
+        Reference reference(mode);
+        vector<shared_ptr<IndexableItem>> items;
+        for (int i = 0; i < 2000; ++i) {
+            QString text = corpus.text();
+            items.push_back(makeItem(QString::number(i), text));
+            reference.add(QString::number(i), text);
+        }
+
+        // Bulk loaded, then staged
+        OfflineIndex index;
+        setMode(index, mode);
+        index.build(vector<shared_ptr<IndexableItem>>(items.begin(), items.begin() + 1500));
+        for (auto it = items.begin() + 1500; it != items.end(); ++it)
+            index.add(*it);
+
+        for (int i = 0; i < 300; ++i)
+            compare(index, reference, corpus.query());
+        index.build();
+        for (int i = 0; i < 300; ++i)
+            compare(index, reference, corpus.query());
+    }
+
+private slots:
+
+    void prefixSearch() { compareSearches(Mode::Prefix); }
+
+    void fuzzySearch() { compareSearches(Mode::Fuzzy); }
+
+    void substringSearch() { compareSearches(Mode::Substring); }
+
+    void saveLoad() {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+
+        for (Mode mode : {Mode::Prefix, Mode::Fuzzy, Mode::Substring}) {
+            Corpus corpus(7);
+            Reference reference(mode);
+            vector<shared_ptr<IndexableItem>> items;
+            OfflineIndex index;
+            setMode(index, mode);
+            for (int i = 0; i < 1000; ++i) {
+                QString text = corpus.text();
+                items.push_back(makeItem(QString::number(i), text));
+                reference.add(QString::number(i), text);
+                index.add(items.back());
+            }
+            for (int i = 0; i < 100; ++i) {
+                const shared_ptr<IndexableItem> &item = items[corpus.random(1000)];
+                index.remove(item);
+                reference.remove(item->id());
+            }
+
+            QString path = dir.filePath("index");
+            QVERIFY(index.save(path));
+            OfflineIndex loaded;
+            QVERIFY(loaded.load(path, items));
+            for (int i = 0; i < 200; ++i) {
+                QString query = corpus.query();
+                QCOMPARE(ids(loaded.search(query)), ids(index.search(query)));
+                compare(loaded, reference, query);
+            }
+
+            // A file missing items is rejected
+            OfflineIndex rejected;
+            QVERIFY(!rejected.load(path, vector<shared_ptr<IndexableItem>>(items.begin(), items.begin() + 500)));
+        }
+    }
+
+    void removeAndCompaction() {
+        for (Mode mode : {Mode::Prefix, Mode::Fuzzy, Mode::Substring}) {
+            Corpus corpus(11);
+            Reference reference(mode);
+            vector<shared_ptr<IndexableItem>> items;
+            for (int i = 0; i < 2000; ++i) {
+                QString text = corpus.text();
+                items.push_back(makeItem(QString::number(i), text));
+                reference.add(QString::number(i), text);
+            }
+            OfflineIndex index;
+            setMode(index, mode);
+            index.build(items);
+
+            // Removing every other item compacts in the background meanwhile,
+            // some are added again with other texts
+            for (int i = 0; i < 1000; ++i) {
+                QString id = QString::number(2 * i);
+                index.remove(makeItem(id, QString()));
+                reference.remove(id);
+                if (i % 10 == 0) {
+                    QString text = corpus.text();
+                    index.add(makeItem(id, text));
+                    reference.add(id, text);
+                }
+                if (i % 50 == 0)
+                    for (int q = 0; q < 20; ++q)
+                        compare(index, reference, corpus.query());
+            }
+            index.build();
+            for (int i = 0; i < 200; ++i)
+                compare(index, reference, corpus.query());
+        }
+    }
+
+    void cursorRefinement() {
+        for (Mode mode : {Mode::Prefix, Mode::Fuzzy, Mode::Substring}) {
+            Corpus corpus(13);
+            Reference reference(mode);
+            OfflineIndex index;
+            setMode(index, mode);
+            for (int i = 0; i < 1000; ++i) {
+                QString text = corpus.text();
+                index.add(makeItem(QString::number(i), text));
+                reference.add(QString::number(i), text);
+            }
+            index.build();
+
+            // Type queries key by key, delete some keys again and modify the
+            // index in between
+            OfflineIndex::Cursor cursor, rankedCursor;
+            for (int n = 0; n < 100; ++n) {
+                QString query = corpus.query();
+                for (int length = 1; length <= query.size(); ++length) {
+                    QString typed = query.left(length);
+                    QCOMPARE(ids(index.search(typed, cursor)), reference.search(typed));
+                    auto ranked = index.search(typed, 10, rankedCursor);
+                    QCOMPARE(ranked.size(), std::min(size_t(10), reference.search(typed).size()));
+                }
+                for (int length = query.size() - 1; length > 0 && corpus.random(2); --length)
+                    QCOMPARE(ids(index.search(query.left(length), cursor)), reference.search(query.left(length)));
+                if (n % 10 == 0) {
+                    QString id = QString::number(1000 + n), text = corpus.text();
+                    index.add(makeItem(id, text));
+                    reference.add(id, text);
+                }
+            }
+        }
+    }
+
+    void duplicateAdd() {
+        OfflineIndex index;
+        index.add(makeItem("1", "firefox"));
+        index.add(makeItem("1", "files"));
+        QCOMPARE(index.search("fi").size(), size_t(1));
+        QCOMPARE(index.search("fire").size(), size_t(0));
+
+        index.remove(makeItem("1", QString()));
+        QCOMPARE(index.search("fi").size(), size_t(0));
+        index.build();
+        QCOMPARE(index.search("fi").size(), size_t(0));
+    }
+
+    void duplicateBuild() {
+        OfflineIndex index;
+        index.add(makeItem("1", "firefox"));
+        index.build({makeItem("1", "files"), makeItem("2", "fish"), makeItem("2", "finch")});
+        QCOMPARE(index.search("fi").size(), size_t(2));
+        QCOMPARE(index.search("fire").size(), size_t(0));
+        QCOMPARE(index.search("fish").size(), size_t(0));
+
+        index.remove(makeItem("1", QString()));
+        index.remove(makeItem("2", QString()));
+        QCOMPARE(index.search("fi").size(), size_t(0));
+        QCOMPARE(index.search("fi", 10).size(), size_t(0));
+    }
+
+};
+
+QTEST_APPLESS_MAIN(OfflineIndexTest)
+#include "offlineindextest.moc"
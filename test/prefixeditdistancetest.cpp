@@ -0,0 +1,96 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#include <QString>
+#include <QTest>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "prefixeditdistance.h"
+using Core::PrefixEditDistance;
+using std::vector;
+
+namespace {
+
+// The DP of FuzzySearch before the bit-parallel kernel, extended to return the
+// minimum of the last row instead of comparing it to delta
+uint referenceDistance(const QString &prefix, const QString &str, uint delta) {
+    uint n = prefix.size() + 1;
+    uint m = std::min(prefix.size() + delta + 1, static_cast<uint>(str.size()) + 1);
+
+    vector<uint> matrix(n*m);
+    for (uint i = 0; i < n; ++i) { matrix[i*m+0] = i; }
+    for (uint i = 0; i < m; ++i) { matrix[0*m+i] = i; }
+    for (uint i = 1; i < n; ++i) {
+        for (uint j = 1; j < m; ++j) {
+            uint dia = matrix[(i-1)*m+j-1] + (prefix[i-1] == str[j-1] ? 0 : 1);
+            matrix[i*m+j] = std::min(std::min(dia, matrix[i*m+j-1] + 1), matrix[(i-1)*m+j] + 1);
+        }
+    }
+
+    uint result = delta + 1;
+    for (uint j = 0; j < m; ++j)
+        result = std::min(result, matrix[(n-1)*m+j]);
+    return result;
+}
+
+QString randomString(std::mt19937 &rng, int length, int alphabet) {
+    QString str;
+    for (int i = 0; i < length; ++i) {
+        // Mix in some characters beyond latin1, they take the other masks
+        int c = static_cast<int>(rng() % static_cast<uint>(alphabet));
+        str.append(c % 5 == 4 ? QChar(0x3b1 + c) : QChar('a' + c));
+    }
+    return str;
+}
+
+}
+
+
+class PrefixEditDistanceTest : public QObject
+{
+    Q_OBJECT
+
+private:
+
+    void compare(const QString &prefix, const QString &str, uint delta) {
+        PrefixEditDistance prefixEditDistance(prefix);
+        uint expected = referenceDistance(prefix, str, delta);
+        QCOMPARE(prefixEditDistance.distance(str, delta), expected);
+        QCOMPARE(prefixEditDistance(str, delta), expected <= delta);
+    }
+
+private slots:
+
+    void boundaries() {
+        QString w64(64, 'a'), w65(65, 'a'), w100(100, 'b');
+        const vector<QString> words{"", "a", "ab", "abc", "ba", w64, w65, w100,
+                                    w64.left(10) + "xyz" + w64.mid(13),
+                                    w65.left(60) + "xyz" + w65.mid(63)};
+        for (const QString &prefix : words)
+            for (const QString &str : words)
+                for (uint delta : {0U, 1U, 2U, 3U,
+                                   static_cast<uint>(prefix.size()),
+                                   static_cast<uint>(prefix.size()) + 1,
+                                   static_cast<uint>(prefix.size()) + 5})
+                    compare(prefix, str, delta);
+    }
+
+    void random() {
+        std::mt19937 rng(42);
+        for (int i = 0; i < 20000; ++i) {
+            int alphabet = 2 + static_cast<int>(rng() % 8);
+            // Up to 80 units, the words above 64 take the band fallback
+            QString prefix = randomString(rng, static_cast<int>(rng() % 81), alphabet);
+            QString str = (rng() % 2)
+                    ? randomString(rng, static_cast<int>(rng() % 90), alphabet)
+                    : prefix.left(static_cast<int>(rng() % (prefix.size() + 1)))
+                      + randomString(rng, static_cast<int>(rng() % 10), alphabet);
+            uint delta = rng() % (static_cast<uint>(prefix.size()) + 3);
+            compare(prefix, str, delta);
+        }
+    }
+
+};
+
+QTEST_APPLESS_MAIN(PrefixEditDistanceTest)
+#include "prefixeditdistancetest.moc"
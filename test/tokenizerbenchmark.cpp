@@ -0,0 +1,111 @@
+// Copyright (C) 2014-2018 Manuel Schneider
+
+#include <QRegularExpression>
+#include <QStringList>
+#include <QTest>
+#include <random>
+#include <vector>
+#include "albert/util/offlineindex.h"
+#include "tokenizer.h"
+using std::vector;
+
+namespace {
+
+// The separators of the tokenizer as regex, as split by SearchBase and
+// PrefixSearch before the table-driven tokenizer
+const char *SEPARATOR_REGEX = "[!?<>\"'=+*.:,;\\\\\\/ _\\-]+";
+
+// The regex tokenizer, lowercasing the words like the DefaultAnalysis
+void referenceTokenize(const QString &string, const QRegularExpression &separators,
+                       vector<QString> &tokens) {
+    for (const QString &word : string.split(separators, QString::SkipEmptyParts))
+        tokens.push_back(word.toLower());
+}
+
+// Index strings like the ones of applications, files and bookmarks
+vector<QString> corpus(const QString &kind) {
+    const vector<QString> words{"Firefox", "Web", "Browser", "LibreOffice", "Writer", "home",
+                                "user", "Documents", "report", "2018", "final", "org", "kde",
+                                "Einstellungen", "Ärger", "Café", "crème", "brûlée", "Straße"};
+    const QString separators(" -_./:");
+    std::mt19937 rng(42);
+    vector<QString> strings;
+    for (int i = 0; i < 10000; ++i) {
+        QString string;
+        int count = 1 + static_cast<int>(rng() % 6);
+        for (int w = 0; w < count; ++w) {
+            // Latin-1 words are looked up in the tables, others fall back to Qt
+            size_t limit = (kind == "ascii") ? 14 : words.size();
+            string.append(words[rng() % limit]);
+            if (kind == "greek" && rng() % 2)
+                string.append(QChar(0x3b1 + static_cast<int>(rng() % 24)));
+            if (w + 1 < count)
+                string.append(separators[static_cast<int>(rng() % static_cast<uint>(separators.size()))]);
+        }
+        strings.push_back(string);
+    }
+    return strings;
+}
+
+}
+
+
+class TokenizerBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+
+    void equivalence_data() {
+        QTest::addColumn<QString>("kind");
+        QTest::newRow("ascii") << "ascii";
+        QTest::newRow("latin1") << "latin1";
+        QTest::newRow("greek") << "greek";
+    }
+
+    void equivalence() {
+        QFETCH(QString, kind);
+        QRegularExpression separators(SEPARATOR_REGEX);
+        vector<QString> tokens, expected;
+        for (const QString &string : corpus(kind)) {
+            tokens.clear();
+            expected.clear();
+            Core::tokenize(string, tokens, Core::OfflineIndex::DefaultAnalysis);
+            referenceTokenize(string, separators, expected);
+            QCOMPARE(tokens, expected);
+        }
+    }
+
+    void regex_data() { equivalence_data(); }
+
+    void regex() {
+        QFETCH(QString, kind);
+        const vector<QString> strings = corpus(kind);
+        QRegularExpression separators(SEPARATOR_REGEX);
+        vector<QString> tokens;
+        QBENCHMARK {
+            for (const QString &string : strings) {
+                tokens.clear();
+                referenceTokenize(string, separators, tokens);
+            }
+        }
+    }
+
+    void tableDriven_data() { equivalence_data(); }
+
+    void tableDriven() {
+        QFETCH(QString, kind);
+        const vector<QString> strings = corpus(kind);
+        vector<QString> tokens;
+        QBENCHMARK {
+            for (const QString &string : strings) {
+                tokens.clear();
+                Core::tokenize(string, tokens, Core::OfflineIndex::DefaultAnalysis);
+            }
+        }
+    }
+
+};
+
+QTEST_APPLESS_MAIN(TokenizerBenchmark)
+#include "tokenizerbenchmark.moc"